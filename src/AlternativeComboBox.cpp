@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "AlternativeComboBox.h"
+
+#include <QFutureWatcher>
+#include <QtConcurrent>
+
+#include "IconCache.h"
+#include "Tileset.h"
+
+AlternativeComboBox::AlternativeComboBox(const Tileset *tileset, unsigned int layer_index, QWidget *parent)
+        : QComboBox(parent)
+        , _tileset(tileset)
+        , _layer_index(layer_index)
+{
+	const auto &layer = _tileset->layers()[_layer_index];
+	// Reserve icon space with a blank icon until the real one is ready
+	QPixmap blank(iconSize());
+	blank.fill(Qt::transparent);
+	for (unsigned int i = 0; i < layer.alternatives.size(); ++i) {
+		const auto &alternative = layer.alternatives[i];
+		if (alternative.sources.empty())
+			addItem(alternative.name, i);
+		else
+			addItem(QIcon(blank), alternative.name, i);
+	}
+	_requested_icons.resize(layer.alternatives.size(), false);
+	connect(this, qOverload<int>(&QComboBox::currentIndexChanged),
+	        this, &AlternativeComboBox::requestIcon);
+}
+
+void AlternativeComboBox::showPopup()
+{
+	for (int i = 0; i < count(); ++i)
+		requestIcon(i);
+	QComboBox::showPopup();
+}
+
+void AlternativeComboBox::showEvent(QShowEvent *event)
+{
+	QComboBox::showEvent(event);
+	requestIcon(currentIndex());
+}
+
+void AlternativeComboBox::requestIcon(int index)
+{
+	if (index < 0 || static_cast<std::size_t>(index) >= _requested_icons.size() || _requested_icons[index])
+		return;
+	_requested_icons[index] = true;
+	const auto &alternative = _tileset->layers()[_layer_index].alternatives[index];
+	if (alternative.sources.empty())
+		return;
+	auto watcher = new QFutureWatcher<QImage>(this);
+	connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, watcher, index] () {
+		auto icon = watcher->result();
+		if (!icon.isNull())
+			setItemIcon(index, QIcon(QPixmap::fromImage(icon)));
+		watcher->deleteLater();
+	});
+	watcher->setFuture(QtConcurrent::run([tileset = _tileset, alternative = &alternative] () {
+		return IconCache::instance().icon(*tileset, *alternative);
+	}));
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef ALTERNATIVE_COMBO_BOX_H
+#define ALTERNATIVE_COMBO_BOX_H
+
+#include <QComboBox>
+
+#include <vector>
+
+class Tileset;
+
+// Combo box listing the alternatives of a tileset layer.
+//
+// Icons are rendered on worker threads (or read from IconCache) only when
+// they are about to be shown: the current item when the combo box is shown,
+// every item when its popup opens.
+class AlternativeComboBox: public QComboBox
+{
+	Q_OBJECT
+public:
+	AlternativeComboBox(const Tileset *tileset, unsigned int layer_index, QWidget *parent = nullptr);
+
+	void showPopup() override;
+
+protected:
+	void showEvent(QShowEvent *event) override;
+
+private:
+	void requestIcon(int index);
+
+	const Tileset *_tileset;
+	unsigned int _layer_index;
+	std::vector<bool> _requested_icons;
+};
+
+#endif // ALTERNATIVE_COMBO_BOX_H
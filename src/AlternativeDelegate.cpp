@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "AlternativeDelegate.h"
+
+#include <QApplication>
+#include <QPainter>
+
+#include <algorithm>
+
+#include "AlternativeComboBox.h"
+#include "ConfigurationModel.h"
+#include "Tileset.h"
+
+AlternativeDelegate::AlternativeDelegate(const std::vector<Tileset *> &tilesets, QObject *parent)
+        : QStyledItemDelegate(parent)
+        , _tilesets(tilesets)
+{
+}
+
+static QStyle *widgetStyle(const QStyleOptionViewItem &option)
+{
+	return option.widget ? option.widget->style() : QApplication::style();
+}
+
+void AlternativeDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+	QStyleOptionComboBox combo_option;
+	initComboBoxOption(&combo_option, option, index);
+	// Only painted rows request their icon
+	combo_option.currentIcon = qvariant_cast<QIcon>(index.data(Qt::DecorationRole));
+	auto style = widgetStyle(option);
+	style->drawComplexControl(QStyle::CC_ComboBox, &combo_option, painter, option.widget);
+	style->drawControl(QStyle::CE_ComboBoxLabel, &combo_option, painter, option.widget);
+}
+
+QSize AlternativeDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+	QStyleOptionComboBox combo_option;
+	initComboBoxOption(&combo_option, option, index);
+	// Wide enough for every alternative, like a combo box
+	int text_width = 0;
+	for (const auto &name: index.data(ConfigurationModel::AlternativesRole).toStringList())
+		text_width = std::max(text_width, option.fontMetrics.horizontalAdvance(name));
+	QSize contents(text_width + combo_option.iconSize.width() + 4,
+	               std::max(option.fontMetrics.height(), combo_option.iconSize.height()));
+	return widgetStyle(option)->sizeFromContents(QStyle::CT_ComboBox, &combo_option, contents, option.widget);
+}
+
+QWidget *AlternativeDelegate::createEditor(QWidget *parent, const QStyleOptionViewItem &, const QModelIndex &index) const
+{
+	auto tileset = _tilesets[index.data(ConfigurationModel::TilesetIndexRole).toUInt()];
+	auto layer_index = index.data(ConfigurationModel::LayerIndexRole).toUInt();
+	auto editor = new AlternativeComboBox(tileset, layer_index, parent);
+	// Apply the selection as soon as it is made, not when the editor closes
+	auto self = const_cast<AlternativeDelegate *>(this);
+	connect(editor, qOverload<int>(&QComboBox::activated), self, [self, editor] () {
+		emit self->commitData(editor);
+	});
+	return editor;
+}
+
+void AlternativeDelegate::setEditorData(QWidget *editor, const QModelIndex &index) const
+{
+	auto combobox = static_cast<QComboBox *>(editor);
+	combobox->setCurrentIndex(combobox->findData(index.data(Qt::EditRole)));
+}
+
+void AlternativeDelegate::setModelData(QWidget *editor, QAbstractItemModel *model, const QModelIndex &index) const
+{
+	auto combobox = static_cast<QComboBox *>(editor);
+	if (combobox->currentIndex() >= 0)
+		model->setData(index, combobox->currentData(), Qt::EditRole);
+}
+
+void AlternativeDelegate::updateEditorGeometry(QWidget *editor, const QStyleOptionViewItem &option, const QModelIndex &) const
+{
+	editor->setGeometry(option.rect);
+}
+
+void AlternativeDelegate::initComboBoxOption(QStyleOptionComboBox *combo_option, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+	if (option.widget)
+		combo_option->initFrom(option.widget);
+	combo_option->rect = option.rect;
+	combo_option->state = (option.state & ~QStyle::State_Selected) | QStyle::State_Enabled;
+	combo_option->frame = true;
+	combo_option->editable = false;
+	combo_option->currentText = index.data(Qt::DisplayRole).toString();
+	combo_option->iconSize = option.decorationSize;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef ALTERNATIVE_DELEGATE_H
+#define ALTERNATIVE_DELEGATE_H
+
+#include <QStyledItemDelegate>
+
+#include <vector>
+
+class Tileset;
+
+// Delegate for ConfigurationModel::AlternativeColumn.
+//
+// Cells are painted as combo boxes. The only AlternativeComboBox instantiated
+// is the editor of the cell being edited, so the panel cost does not grow
+// with the item count.
+class AlternativeDelegate: public QStyledItemDelegate
+{
+	Q_OBJECT
+public:
+	AlternativeDelegate(const std::vector<Tileset *> &tilesets, QObject *parent = nullptr);
+
+	void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+	QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+	QWidget *createEditor(QWidget *parent, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+	void setEditorData(QWidget *editor, const QModelIndex &index) const override;
+	void setModelData(QWidget *editor, QAbstractItemModel *model, const QModelIndex &index) const override;
+	void updateEditorGeometry(QWidget *editor, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
+
+private:
+	// Everything but the icon, which is only read when painting
+	void initComboBoxOption(QStyleOptionComboBox *combo_option, const QStyleOptionViewItem &option, const QModelIndex &index) const;
+
+	std::vector<Tileset *> _tilesets;
+};
+
+#endif // ALTERNATIVE_DELEGATE_H
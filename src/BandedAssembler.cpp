@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "BandedAssembler.h"
+
+#include <QImageIOHandler>
+#include <QImageReader>
+#include <QPainter>
+#include <QtConcurrent>
+
+#include <map>
+#include <memory>
+
+#include "Compositor.h"
+#include "PngRowReader.h"
+#include "PngRowWriter.h"
+#include "Resampler.h"
+#include "SheetNormalizer.h"
+#include "Tileset.h"
+
+#include <QtDebug>
+
+namespace {
+
+// Source file read band by band
+struct sheet_t {
+	QString filename;
+	QColor color_key;
+	TilemapInfo info; // tile geometry of the sheet, empty if the file cannot be read
+	std::unique_ptr<PngRowReader> png; // sequential reader, null for other formats
+	bool clip = false; // other formats whose reader decodes clip rects natively
+	QImage whole; // normalized sheet, for formats that can only be decoded whole
+	QImage band; // tile rows of the current band
+
+	void open(const QSize &tilemap_size)
+	{
+		QSize size;
+		png = std::make_unique<PngRowReader>(filename);
+		if (png->open())
+			size = png->size();
+		else {
+			png.reset();
+			QImageReader reader(filename);
+			size = reader.size();
+			clip = reader.supportsOption(QImageIOHandler::ClipRect);
+			if (size.isValid() && !clip) {
+				// Decoding every band would decode the whole sheet each time
+				qWarning().noquote() << BandedAssembler::tr("%1 cannot be read by bands (interlaced PNG or unsupported format), "
+				                                            "it is decoded whole and memory is not bounded for it.").arg(filename);
+				whole = SheetNormalizer::normalize(reader.read(), color_key);
+				if (whole.isNull())
+					size = QSize();
+			}
+		}
+		if (!size.isValid()) {
+			qCritical().noquote() << BandedAssembler::tr("Failed to load source image from %1.").arg(filename);
+			return;
+		}
+		info = TilemapInfo(QSize(size.width()/tilemap_size.width(),
+		                         size.height()/tilemap_size.height()),
+		                   tilemap_size);
+	}
+
+	void readBand(int first_row, int row_count)
+	{
+		const auto &tile_size = info.tileSize();
+		if (tile_size.isEmpty())
+			return;
+		const QRect rect(0, first_row * tile_size.height(),
+		                 info.pixmapSize().width(), row_count * tile_size.height());
+		if (!png && !clip) {
+			band = whole.copy(rect);
+			return;
+		}
+		QImage image;
+		if (png) // bands are read in order
+			image = png->readRows(rect.height());
+		else {
+			QImageReader reader(filename);
+			reader.setClipRect(rect);
+			image = reader.read();
+		}
+		if (image.isNull()) {
+			qCritical().noquote() << BandedAssembler::tr("Failed to read rows from %1.").arg(filename);
+			info = TilemapInfo(); // ignore the following bands
+		}
+		band = SheetNormalizer::normalize(image, color_key);
+	}
+};
+
+}
+
+BandedAssembler::BandedAssembler(const Tileset &tileset, const std::vector<unsigned int> &selection,
+                                 unsigned int image_index)
+        : _tileset(tileset)
+        , _selection(selection)
+        , _image_index(image_index)
+{
+}
+
+bool BandedAssembler::save(const QString &filename, unsigned int band_rows) const
+{
+	const auto &info = _tileset.tilesetInfo();
+	const auto &tile_size = info.tileSize();
+	const int tilemap_width = info.tilemapWidth(), tilemap_height = info.tilemapHeight();
+
+	PngRowWriter writer(filename, info.pixmapSize());
+	if (!writer.open()) {
+		qCritical().noquote() << tr("Cannot write %1: %2").arg(filename).arg(writer.errorString());
+		return false;
+	}
+
+	// Open the sources of the selection, files are shared between sources
+	// using different filters.
+	struct layer_source_t {
+		const sheet_t *sheet;
+		QPainter::CompositionMode mode;
+		Resampler::Filter filter;
+	};
+	std::map<QString, sheet_t> sheets;
+	std::vector<std::vector<layer_source_t>> layer_sources;
+	const auto &layers = _tileset.layers();
+	for (unsigned int i = 0; i < layers.size(); ++i) {
+		layer_sources.emplace_back();
+		for (const auto &p: layers[i].alternatives[_selection[i]].sources) {
+			auto filenames = _tileset.sourceFileNames(p.first->name);
+			if (_image_index >= filenames.size())
+				continue;
+			auto &sheet = sheets[filenames[_image_index]];
+			sheet.filename = filenames[_image_index];
+			sheet.color_key = _tileset.colorKey();
+			layer_sources.back().push_back({ &sheet, p.second, p.first->filter });
+		}
+	}
+	std::vector<sheet_t *> sheet_list;
+	for (auto &p: sheets)
+		sheet_list.push_back(&p.second);
+	QtConcurrent::blockingMap(sheet_list, [&info] (sheet_t *sheet) {
+		sheet->open(info.tilemapSize());
+	});
+
+	const auto rows_per_band = std::max(1, static_cast<int>(band_rows));
+	for (int first_row = 0; first_row < tilemap_height; first_row += rows_per_band) {
+		const auto row_count = std::min(rows_per_band, tilemap_height - first_row);
+		QtConcurrent::blockingMap(sheet_list, [first_row, row_count] (sheet_t *sheet) {
+			sheet->readBand(first_row, row_count);
+		});
+
+		const auto first_tile = static_cast<unsigned int>(first_row * tilemap_width);
+		const auto end_tile = static_cast<unsigned int>((first_row + row_count) * tilemap_width);
+		const QPoint band_offset(0, first_row * tile_size.height());
+		QImage band(info.pixmapSize().width(), row_count * tile_size.height(),
+		            QImage::Format_ARGB32_Premultiplied);
+		band.fill(Qt::transparent);
+		// Same drawing as Tileset::compositeLayer, restricted to the band
+		for (unsigned int i = 0; i < layers.size(); ++i) {
+			info.forEachTile(layers[i].tiles, [&] (unsigned int tile, const QRect &rect) {
+				if (tile < first_tile || tile >= end_tile)
+					return;
+				for (const auto &source: layer_sources[i]) {
+					const auto &sheet = *source.sheet;
+					if (sheet.band.isNull())
+						continue;
+					const auto &sheet_tile_size = sheet.info.tileSize();
+					auto src_rect = sheet.info.tileRect(tile).translated(0, -first_row * sheet_tile_size.height());
+					if (sheet_tile_size == tile_size)
+						Compositor::composite(band, rect.topLeft() - band_offset, sheet.band, src_rect, source.mode);
+					else
+						Compositor::composite(band, rect.topLeft() - band_offset,
+						                      Resampler::resample(sheet.band.copy(src_rect), tile_size, source.filter),
+						                      source.mode);
+				}
+			});
+		}
+		if (!writer.writeRows(band)) {
+			qCritical().noquote() << tr("Cannot write %1: %2").arg(filename).arg(writer.errorString());
+			return false;
+		}
+	}
+	if (!writer.commit()) {
+		qCritical().noquote() << tr("Cannot write %1: %2").arg(filename).arg(writer.errorString());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef BANDED_ASSEMBLER_H
+#define BANDED_ASSEMBLER_H
+
+#include <QCoreApplication>
+
+#include <vector>
+
+class Tileset;
+
+// Assemble and save one output image of a tileset selection, band of tile
+// rows by band, for sheets too large to be assembled in memory.
+//
+// Only the current band of the output and of each source is kept: PNG
+// sources are decoded row by row (other formats through
+// QImageReader::setClipRect) and the output is encoded as bands are done.
+// Interlaced PNG and formats without native clip rect support are decoded
+// whole once instead, memory is not bounded for them.
+// The tileset may be parsed only (see Pack::Source::TextParseOnly).
+class BandedAssembler
+{
+	Q_DECLARE_TR_FUNCTIONS(BandedAssembler)
+public:
+	// selection contains an alternative index for each layer, image_index
+	// is the output index (see Tileset::outputs).
+	BandedAssembler(const Tileset &tileset, const std::vector<unsigned int> &selection,
+	                unsigned int image_index);
+
+	bool save(const QString &filename, unsigned int band_rows) const;
+
+private:
+	const Tileset &_tileset;
+	std::vector<unsigned int> _selection;
+	unsigned int _image_index;
+};
+
+#endif // BANDED_ASSEMBLER_H
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "CMVReader.h"
+
+#include <QDataStream>
+#include <QFile>
+
+#include <QtDebug>
+
+constexpr std::size_t CMVReader::MaxQueuedFrames;
+
+static constexpr quint32 CMVVersion = 10000;
+static constexpr quint32 CMVVersionSounds = 10001;
+static constexpr int SoundNameLength = 50;
+static constexpr int SoundTimingsSize = 200*16*sizeof(quint32);
+static constexpr int MaxDimension = 4096;
+
+CMVReader::CMVReader(const QString &filename, QObject *parent)
+        : QThread(parent)
+        , _filename(filename)
+        , _stop(false)
+{
+	QFile file(filename);
+	if (!file.open(QIODevice::ReadOnly))
+		throw std::runtime_error(tr("Failed to open \"%1\".").arg(filename).toLocal8Bit().data());
+	QDataStream stream(&file);
+	stream.setByteOrder(QDataStream::LittleEndian);
+	quint32 version, columns, rows, delay_rate;
+	stream >> version >> columns >> rows >> delay_rate;
+	if (stream.status() != QDataStream::Ok)
+		throw std::runtime_error(tr("Truncated movie header").toLocal8Bit().data());
+	if (version != CMVVersion && version != CMVVersionSounds)
+		throw std::runtime_error(tr("Unsupported movie version: %1").arg(version).toLocal8Bit().data());
+	if (columns == 0 || rows == 0 || columns > MaxDimension || rows > MaxDimension)
+		throw std::runtime_error(tr("Invalid movie size").toLocal8Bit().data());
+	if (version == CMVVersionSounds) {
+		quint32 sound_count;
+		stream >> sound_count;
+		if (stream.status() != QDataStream::Ok ||
+		    !file.seek(file.pos() + sound_count*SoundNameLength + SoundTimingsSize))
+			throw std::runtime_error(tr("Truncated movie header").toLocal8Bit().data());
+	}
+	_size = QSize(static_cast<int>(columns), static_cast<int>(rows));
+	// delay rate is in hundredths of a second
+	_frame_interval = std::max(10, static_cast<int>(delay_rate) * 10);
+	_data_offset = file.pos();
+}
+
+CMVReader::~CMVReader()
+{
+	stop();
+	wait();
+}
+
+const QString &CMVReader::fileName() const
+{
+	return _filename;
+}
+
+const QSize &CMVReader::size() const
+{
+	return _size;
+}
+
+int CMVReader::frameInterval() const
+{
+	return _frame_interval;
+}
+
+bool CMVReader::nextFrame(frame_t &frame)
+{
+	QMutexLocker lock(&_mutex);
+	if (_frames.empty())
+		return false;
+	frame = std::move(_frames.front());
+	_frames.pop_front();
+	_not_full.wakeOne();
+	return true;
+}
+
+void CMVReader::stop()
+{
+	QMutexLocker lock(&_mutex);
+	_stop = true;
+	_not_full.wakeAll();
+}
+
+bool CMVReader::push(frame_t &&frame)
+{
+	QMutexLocker lock(&_mutex);
+	while (_frames.size() >= MaxQueuedFrames && !_stop)
+		_not_full.wait(&_mutex);
+	if (_stop)
+		return false;
+	_frames.push_back(std::move(frame));
+	return true;
+}
+
+void CMVReader::run()
+{
+	QFile file(_filename);
+	if (!file.open(QIODevice::ReadOnly) || !file.seek(_data_offset)) {
+		qCritical().noquote() << tr("Failed to open \"%1\".").arg(_filename);
+		return;
+	}
+	QDataStream stream(&file);
+	stream.setByteOrder(QDataStream::LittleEndian);
+
+	const auto columns = static_cast<unsigned int>(_size.width());
+	const auto rows = static_cast<unsigned int>(_size.height());
+	const int cell_count = _size.width() * _size.height();
+	const int frame_size = 2 * cell_count;
+	bool has_frames = false;
+	QByteArray pending; // frame data split across chunks
+	forever {
+		quint32 chunk_size;
+		stream >> chunk_size;
+		if (stream.status() != QDataStream::Ok) {
+			if (!has_frames) {
+				qCritical().noquote() << tr("Movie %1 contains no frame").arg(_filename);
+				return;
+			}
+			// loop back to the first chunk
+			stream.resetStatus();
+			pending.clear();
+			file.seek(_data_offset);
+			continue;
+		}
+		// qUncompress expects a big endian size hint before zlib data,
+		// it grows its buffer if the hint is too small.
+		QByteArray chunk(4, '\0');
+		quint32 size_hint = std::max<quint32>(chunk_size * 8, frame_size);
+		for (int i = 0; i < 4; ++i)
+			chunk[i] = static_cast<char>((size_hint >> (24 - 8*i)) & 0xff);
+		chunk.append(file.read(chunk_size));
+		if (chunk.size() != static_cast<int>(chunk_size) + 4) {
+			qCritical().noquote() << tr("Truncated movie chunk in %1").arg(_filename);
+			return;
+		}
+		pending.append(qUncompress(chunk));
+		if (pending.isEmpty()) {
+			qCritical().noquote() << tr("Invalid movie chunk in %1").arg(_filename);
+			return;
+		}
+		int offset = 0;
+		for (; offset + frame_size <= pending.size(); offset += frame_size) {
+			// CMV cells are stored column-major, tile codes first then colors
+			auto tiles = reinterpret_cast<const uint8_t *>(pending.constData() + offset);
+			auto colors = tiles + cell_count;
+			frame_t frame;
+			frame.tiles.resize(static_cast<std::size_t>(cell_count));
+			frame.fg_colors.resize(static_cast<std::size_t>(cell_count));
+			frame.bg_colors.resize(static_cast<std::size_t>(cell_count));
+			for (unsigned int x = 0; x < columns; ++x) {
+				for (unsigned int y = 0; y < rows; ++y) {
+					auto src = x * rows + y;
+					auto dest = y * columns + x;
+					auto color = colors[src];
+					frame.tiles[dest] = tiles[src];
+					frame.fg_colors[dest] = static_cast<uint8_t>((color & 7) | ((color >> 3) & 8));
+					frame.bg_colors[dest] = static_cast<uint8_t>((color >> 3) & 7);
+				}
+			}
+			if (!push(std::move(frame)))
+				return;
+			has_frames = true;
+		}
+		pending.remove(0, offset);
+	}
+}
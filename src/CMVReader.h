@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CMV_READER_H
+#define CMV_READER_H
+
+#include <QMutex>
+#include <QSize>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <deque>
+#include <vector>
+
+// Decodes Dwarf Fortress CMV movies on a background thread.
+//
+// The header is read when the reader is created, frames are decoded one
+// compressed chunk at a time and kept in a bounded queue, so only a few
+// frames are ever held in memory. The movie loops when the end is reached.
+class CMVReader: public QThread
+{
+	Q_OBJECT
+public:
+	static constexpr std::size_t MaxQueuedFrames = 64;
+
+	struct frame_t {
+		// row-major cell arrays, as in PreviewWidget layers
+		std::vector<uint8_t> tiles;
+		std::vector<uint8_t> fg_colors;
+		std::vector<uint8_t> bg_colors;
+	};
+
+	explicit CMVReader(const QString &filename, QObject *parent = nullptr);
+	~CMVReader() override;
+
+	const QString &fileName() const;
+	const QSize &size() const; // in cells
+	int frameInterval() const; // in milliseconds
+
+	// Pop the next decoded frame, return false if none is ready yet.
+	bool nextFrame(frame_t &frame);
+	void stop();
+
+protected:
+	void run() override;
+
+private:
+	bool push(frame_t &&frame);
+
+	QString _filename;
+	QSize _size;
+	int _frame_interval;
+	qint64 _data_offset;
+
+	QMutex _mutex;
+	QWaitCondition _not_full;
+	std::deque<frame_t> _frames;
+	bool _stop;
+};
+
+#endif // CMV_READER_H
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "CompositeCache.h"
+
+#include "PerfCounters.h"
+
+#include <iterator>
+
+CompositeCache::CompositeCache(const Tileset &tileset)
+        : _tileset(tileset)
+        , _bytes(0)
+{
+}
+
+Tileset::images_t CompositeCache::images(const std::vector<unsigned int> &selection)
+{
+	// Find the longest prefix already composited
+	std::vector<unsigned int> prefix = selection;
+	Tileset::images_t images;
+	{
+		QMutexLocker lock(&_mutex);
+		for (;;) {
+			auto it = _index.find(prefix);
+			if (it != _index.end()) {
+				_composites.splice(_composites.begin(), _composites, it->second);
+				images = it->second->second;
+				break;
+			}
+			if (prefix.empty()) {
+				images = _tileset.blankImages();
+				break;
+			}
+			prefix.pop_back();
+		}
+	}
+	PerfCounters::instance().addCacheAccess(PerfCounters::Cache::Composite,
+	                                        prefix.size() == selection.size());
+	// Composite the remaining layers outside the lock, images are shared
+	// with the cache until painted on.
+	while (prefix.size() < selection.size()) {
+		auto layer = static_cast<unsigned int>(prefix.size());
+		_tileset.compositeLayer(images, layer, selection[layer]);
+		prefix.push_back(selection[layer]);
+		QMutexLocker lock(&_mutex);
+		insert(prefix, images);
+	}
+	return images;
+}
+
+static qint64 imagesBytes(const Tileset::images_t &images)
+{
+	qint64 bytes = 0;
+	for (const auto &image: images)
+		bytes += image.sizeInBytes();
+	return bytes;
+}
+
+void CompositeCache::insert(const std::vector<unsigned int> &prefix, const Tileset::images_t &images)
+{
+	if (_index.find(prefix) != _index.end())
+		return; // composited concurrently by another request
+	_composites.emplace_front(prefix, images);
+	_index.emplace(prefix, _composites.begin());
+	_bytes += imagesBytes(images);
+	while (_bytes > Tileset::AssembledCacheBytes && !_composites.empty()) {
+		// Least recently used of the longest prefixes
+		auto victim = std::prev(_composites.end());
+		for (auto it = victim; it != _composites.begin(); ) {
+			--it;
+			if (it->first.size() > victim->first.size())
+				victim = it;
+		}
+		_bytes -= imagesBytes(victim->second);
+		_index.erase(victim->first);
+		_composites.erase(victim);
+	}
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef COMPOSITE_CACHE_H
+#define COMPOSITE_CACHE_H
+
+#include <QMutex>
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include "Tileset.h"
+
+// Assembled images of a tileset for arbitrary alternative selections.
+//
+// Composites of selection prefixes are kept, so a selection differing
+// from a previous one only in its upper layers only composites those.
+// They are kept within Tileset::AssembledCacheBytes, longest prefixes are
+// evicted first as shorter ones are shared by more selections.
+// Thread-safe.
+class CompositeCache
+{
+public:
+	explicit CompositeCache(const Tileset &tileset);
+
+	// selection contains an alternative index for each layer
+	Tileset::images_t images(const std::vector<unsigned int> &selection);
+
+private:
+	using entry_t = std::pair<std::vector<unsigned int>, Tileset::images_t>;
+
+	// Must be called with _mutex locked
+	void insert(const std::vector<unsigned int> &prefix, const Tileset::images_t &images);
+
+	const Tileset &_tileset;
+	QMutex _mutex;
+	std::list<entry_t> _composites; // most recently used first
+	std::map<std::vector<unsigned int>, std::list<entry_t>::iterator> _index;
+	qint64 _bytes;
+};
+
+#endif // COMPOSITE_CACHE_H
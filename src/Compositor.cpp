@@ -0,0 +1,523 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "Compositor.h"
+
+#include <QtMath>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <QtDebug>
+
+namespace {
+
+// Scalar operations use the same rounding as the Qt raster engine
+
+inline uint div255(uint x)
+{
+	return (x + (x >> 8) + 0x80) >> 8;
+}
+
+// Multiply each channel of x by a/255
+inline uint byteMul(uint x, uint a)
+{
+	uint t = (x & 0xff00ff) * a;
+	t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+	t &= 0xff00ff;
+	x = ((x >> 8) & 0xff00ff) * a;
+	x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+	x &= 0xff00ff00;
+	return x | t;
+}
+
+// (x*a + y*b)/255 for each channel
+inline uint interpolate255(uint x, uint a, uint y, uint b)
+{
+	uint t = (x & 0xff00ff) * a + (y & 0xff00ff) * b;
+	t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+	t &= 0xff00ff;
+	x = ((x >> 8) & 0xff00ff) * a + ((y >> 8) & 0xff00ff) * b;
+	x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+	x &= 0xff00ff00;
+	return x | t;
+}
+
+inline uint inverseAlpha(uint p)
+{
+	return qAlpha(~p);
+}
+
+// Alpha of the separable blend modes
+inline int mixAlpha(int da, int sa)
+{
+	return 255 - static_cast<int>(div255(static_cast<uint>((255 - sa) * (255 - da))));
+}
+
+// Porter-Duff operators, pixel(d, s) returns the new destination pixel
+
+struct ClearOp { static uint pixel(uint, uint) { return 0; } };
+struct SourceOp { static uint pixel(uint, uint s) { return s; } };
+struct DestinationOp { static uint pixel(uint d, uint) { return d; } };
+struct SourceOverOp {
+	static uint pixel(uint d, uint s)
+	{
+		if (qAlpha(s) == 255)
+			return s;
+		if (s == 0)
+			return d;
+		return s + byteMul(d, inverseAlpha(s));
+	}
+};
+struct DestinationOverOp { static uint pixel(uint d, uint s) { return d + byteMul(s, inverseAlpha(d)); } };
+struct SourceInOp { static uint pixel(uint d, uint s) { return byteMul(s, qAlpha(d)); } };
+struct DestinationInOp { static uint pixel(uint d, uint s) { return byteMul(d, qAlpha(s)); } };
+struct SourceOutOp { static uint pixel(uint d, uint s) { return byteMul(s, inverseAlpha(d)); } };
+struct DestinationOutOp { static uint pixel(uint d, uint s) { return byteMul(d, inverseAlpha(s)); } };
+struct SourceAtopOp { static uint pixel(uint d, uint s) { return interpolate255(s, qAlpha(d), d, inverseAlpha(s)); } };
+struct DestinationAtopOp { static uint pixel(uint d, uint s) { return interpolate255(d, qAlpha(s), s, inverseAlpha(d)); } };
+struct XorOp { static uint pixel(uint d, uint s) { return interpolate255(s, inverseAlpha(d), d, inverseAlpha(s)); } };
+struct PlusOp {
+	static uint pixel(uint d, uint s)
+	{
+		uint result = 0;
+		for (int shift = 0; shift < 32; shift += 8)
+			result |= std::min(((d >> shift) & 0xff) + ((s >> shift) & 0xff), 255u) << shift;
+		return result;
+	}
+};
+
+// Separable blend modes, computed for each color channel from the
+// destination and source values and alphas.
+
+inline int div255(int x)
+{
+	return static_cast<int>(div255(static_cast<uint>(x)));
+}
+
+int multiply(int dst, int src, int da, int sa)
+{
+	return div255(src * dst + src * (255 - da) + dst * (255 - sa));
+}
+
+int screen(int dst, int src, int, int)
+{
+	return src + dst - div255(src * dst);
+}
+
+int overlay(int dst, int src, int da, int sa)
+{
+	const int temp = src * (255 - da) + dst * (255 - sa);
+	if (2 * dst < da)
+		return div255(2 * src * dst + temp);
+	return div255(sa * da - 2 * (da - dst) * (sa - src) + temp);
+}
+
+int darken(int dst, int src, int da, int sa)
+{
+	const int temp = src * (255 - da) + dst * (255 - sa);
+	return div255(std::min(src * da, dst * sa) + temp);
+}
+
+int lighten(int dst, int src, int da, int sa)
+{
+	const int temp = src * (255 - da) + dst * (255 - sa);
+	return div255(std::max(src * da, dst * sa) + temp);
+}
+
+int colorDodge(int dst, int src, int da, int sa)
+{
+	const int sa_da = sa * da, dst_sa = dst * sa, src_da = src * da;
+	const int temp = src * (255 - da) + dst * (255 - sa);
+	if (src_da + dst_sa >= sa_da)
+		return div255(sa_da + temp);
+	if (src == sa || sa == 0)
+		return div255(temp);
+	return div255(255 * dst_sa / (255 - 255 * src / sa) + temp);
+}
+
+int colorBurn(int dst, int src, int da, int sa)
+{
+	const int src_da = src * da, dst_sa = dst * sa, sa_da = sa * da;
+	const int temp = src * (255 - da) + dst * (255 - sa);
+	if (src_da + dst_sa < sa_da)
+		return div255(temp);
+	if (src == 0)
+		return div255(dst_sa + temp);
+	return div255(sa * (src_da + dst_sa - sa_da) / src + temp);
+}
+
+int hardLight(int dst, int src, int da, int sa)
+{
+	const int temp = src * (255 - da) + dst * (255 - sa);
+	if (2 * src < sa)
+		return div255(2 * src * dst + temp);
+	return div255(sa * da - 2 * (da - dst) * (sa - src) + temp);
+}
+
+int softLight(int dst, int src, int da, int sa)
+{
+	const int src2 = src << 1;
+	const int dst_np = da != 0 ? (255 * dst) / da : 0;
+	const int temp = (src * (255 - da) + dst * (255 - sa)) * 255;
+	if (src2 < sa)
+		return (dst * (sa * 255 + (src2 - sa) * (255 - dst_np)) + temp) / 65025;
+	if (4 * dst <= da)
+		return (dst * sa * 255 + da * (src2 - sa) * ((((16 * dst_np - 12 * 255) * dst_np + 3 * 65025) * dst_np) / 65025) + temp) / 65025;
+	return (dst * sa * 255 + da * (src2 - sa) * (int(qSqrt(qreal(dst_np * 255))) - dst_np) + temp) / 65025;
+}
+
+int difference(int dst, int src, int da, int sa)
+{
+	return src + dst - div255(2 * std::min(src * da, dst * sa));
+}
+
+int exclusion(int dst, int src, int, int)
+{
+	return src + dst - div255(2 * src * dst);
+}
+
+template<int (*Op)(int, int, int, int)>
+struct BlendOp {
+	static uint pixel(uint d, uint s)
+	{
+		const int da = qAlpha(d), sa = qAlpha(s);
+		return qRgba(Op(qRed(d), qRed(s), da, sa),
+		             Op(qGreen(d), qGreen(s), da, sa),
+		             Op(qBlue(d), qBlue(s), da, sa),
+		             mixAlpha(da, sa));
+	}
+};
+
+using row_function_t = void (*)(uint *dest, const uint *src, int count);
+
+template<typename Op>
+void scalarRow(uint *dest, const uint *src, int count)
+{
+	for (int i = 0; i < count; ++i)
+		dest[i] = Op::pixel(dest[i], src[i]);
+}
+
+void sourceRow(uint *dest, const uint *src, int count)
+{
+	std::copy_n(src, count, dest);
+}
+
+void destinationRow(uint *, const uint *, int)
+{
+}
+
+#ifdef __SSE2__
+// Kernels work on 4 pixels at a time, widened to 16 bits per channel in
+// two vectors of 2 pixels. Lanes 3 and 7 are the alpha channels.
+
+inline __m128i div255Epi16(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_srli_epi16(x, 8));
+	x = _mm_add_epi16(x, _mm_set1_epi16(0x80));
+	return _mm_srli_epi16(x, 8);
+}
+
+inline __m128i broadcastAlphaEpi16(__m128i x)
+{
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+inline __m128i mixAlphaEpi16(__m128i da, __m128i sa)
+{
+	const __m128i full = _mm_set1_epi16(255);
+	auto product = _mm_mullo_epi16(_mm_sub_epi16(full, sa), _mm_sub_epi16(full, da));
+	return _mm_sub_epi16(full, div255Epi16(product));
+}
+
+// Replace the alpha lanes of color with those of alpha
+inline __m128i withAlphaEpi16(__m128i color, __m128i alpha)
+{
+	const __m128i mask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	return _mm_or_si128(_mm_andnot_si128(mask, color), _mm_and_si128(mask, alpha));
+}
+
+// Apply op(d, s, da, sa) to widened pixels, the remaining pixels use ScalarOp
+template<typename ScalarOp, typename Op>
+inline void sse2Row(uint *dest, const uint *src, int count, Op op)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		auto d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dest + i));
+		auto s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		auto d_lo = _mm_unpacklo_epi8(d, zero), d_hi = _mm_unpackhi_epi8(d, zero);
+		auto s_lo = _mm_unpacklo_epi8(s, zero), s_hi = _mm_unpackhi_epi8(s, zero);
+		auto lo = op(d_lo, s_lo, broadcastAlphaEpi16(d_lo), broadcastAlphaEpi16(s_lo));
+		auto hi = op(d_hi, s_hi, broadcastAlphaEpi16(d_hi), broadcastAlphaEpi16(s_hi));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), _mm_packus_epi16(lo, hi));
+	}
+	scalarRow<ScalarOp>(dest + i, src + i, count - i);
+}
+
+void sourceOverRowSse2(uint *dest, const uint *src, int count)
+{
+	sse2Row<SourceOverOp>(dest, src, count, [] (__m128i d, __m128i s, __m128i, __m128i sa) {
+		auto inverse = _mm_sub_epi16(_mm_set1_epi16(255), sa);
+		return _mm_add_epi16(s, div255Epi16(_mm_mullo_epi16(d, inverse)));
+	});
+}
+
+void destinationInRowSse2(uint *dest, const uint *src, int count)
+{
+	sse2Row<DestinationInOp>(dest, src, count, [] (__m128i d, __m128i, __m128i, __m128i sa) {
+		return div255Epi16(_mm_mullo_epi16(d, sa));
+	});
+}
+
+void destinationOutRowSse2(uint *dest, const uint *src, int count)
+{
+	sse2Row<DestinationOutOp>(dest, src, count, [] (__m128i d, __m128i, __m128i, __m128i sa) {
+		auto inverse = _mm_sub_epi16(_mm_set1_epi16(255), sa);
+		return div255Epi16(_mm_mullo_epi16(d, inverse));
+	});
+}
+
+void multiplyRowSse2(uint *dest, const uint *src, int count)
+{
+	sse2Row<BlendOp<multiply>>(dest, src, count, [] (__m128i d, __m128i s, __m128i da, __m128i sa) {
+		const __m128i full = _mm_set1_epi16(255);
+		// sums stay below 65026 for premultiplied pixels
+		auto sum = _mm_mullo_epi16(s, d);
+		sum = _mm_add_epi16(sum, _mm_mullo_epi16(s, _mm_sub_epi16(full, da)));
+		sum = _mm_add_epi16(sum, _mm_mullo_epi16(d, _mm_sub_epi16(full, sa)));
+		return withAlphaEpi16(div255Epi16(sum), mixAlphaEpi16(da, sa));
+	});
+}
+
+void screenRowSse2(uint *dest, const uint *src, int count)
+{
+	sse2Row<BlendOp<screen>>(dest, src, count, [] (__m128i d, __m128i s, __m128i da, __m128i sa) {
+		auto color = _mm_sub_epi16(_mm_add_epi16(s, d), div255Epi16(_mm_mullo_epi16(s, d)));
+		return withAlphaEpi16(color, mixAlphaEpi16(da, sa));
+	});
+}
+
+void plusRowSse2(uint *dest, const uint *src, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		auto d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dest + i));
+		auto s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i), _mm_adds_epu8(d, s));
+	}
+	scalarRow<PlusOp>(dest + i, src + i, count - i);
+}
+#endif
+
+row_function_t rowFunction(QPainter::CompositionMode mode)
+{
+	switch (mode) {
+#ifdef __SSE2__
+	case QPainter::CompositionMode_SourceOver: return sourceOverRowSse2;
+	case QPainter::CompositionMode_DestinationIn: return destinationInRowSse2;
+	case QPainter::CompositionMode_DestinationOut: return destinationOutRowSse2;
+	case QPainter::CompositionMode_Plus: return plusRowSse2;
+	case QPainter::CompositionMode_Multiply: return multiplyRowSse2;
+	case QPainter::CompositionMode_Screen: return screenRowSse2;
+#else
+	case QPainter::CompositionMode_SourceOver: return scalarRow<SourceOverOp>;
+	case QPainter::CompositionMode_DestinationIn: return scalarRow<DestinationInOp>;
+	case QPainter::CompositionMode_DestinationOut: return scalarRow<DestinationOutOp>;
+	case QPainter::CompositionMode_Plus: return scalarRow<PlusOp>;
+	case QPainter::CompositionMode_Multiply: return scalarRow<BlendOp<multiply>>;
+	case QPainter::CompositionMode_Screen: return scalarRow<BlendOp<screen>>;
+#endif
+	case QPainter::CompositionMode_Source: return sourceRow;
+	case QPainter::CompositionMode_Destination: return destinationRow;
+	case QPainter::CompositionMode_Clear: return scalarRow<ClearOp>;
+	case QPainter::CompositionMode_DestinationOver: return scalarRow<DestinationOverOp>;
+	case QPainter::CompositionMode_SourceIn: return scalarRow<SourceInOp>;
+	case QPainter::CompositionMode_SourceOut: return scalarRow<SourceOutOp>;
+	case QPainter::CompositionMode_SourceAtop: return scalarRow<SourceAtopOp>;
+	case QPainter::CompositionMode_DestinationAtop: return scalarRow<DestinationAtopOp>;
+	case QPainter::CompositionMode_Xor: return scalarRow<XorOp>;
+	case QPainter::CompositionMode_Overlay: return scalarRow<BlendOp<overlay>>;
+	case QPainter::CompositionMode_Darken: return scalarRow<BlendOp<darken>>;
+	case QPainter::CompositionMode_Lighten: return scalarRow<BlendOp<lighten>>;
+	case QPainter::CompositionMode_ColorDodge: return scalarRow<BlendOp<colorDodge>>;
+	case QPainter::CompositionMode_ColorBurn: return scalarRow<BlendOp<colorBurn>>;
+	case QPainter::CompositionMode_HardLight: return scalarRow<BlendOp<hardLight>>;
+	case QPainter::CompositionMode_SoftLight: return scalarRow<BlendOp<softLight>>;
+	case QPainter::CompositionMode_Difference: return scalarRow<BlendOp<difference>>;
+	case QPainter::CompositionMode_Exclusion: return scalarRow<BlendOp<exclusion>>;
+	default:
+		qWarning() << "Unsupported composition mode" << mode << "using SourceOver";
+		return scalarRow<SourceOverOp>;
+	}
+}
+
+// Expand a row of pixels in a compact format to premultiplied ARGB32
+void expandRow(Compositor::Format format, const uchar *src, uint *dest, int count)
+{
+	switch (format) {
+	case Compositor::Format::ARGB32Premultiplied:
+		std::copy_n(reinterpret_cast<const uint *>(src), count, dest);
+		return;
+	case Compositor::Format::WhiteAlpha8:
+		for (int i = 0; i < count; ++i)
+			dest[i] = src[i] * 0x01010101u;
+		return;
+	case Compositor::Format::GrayAlpha16:
+		for (int i = 0; i < count; ++i, src += 2)
+			dest[i] = (static_cast<uint>(src[1]) << 24) | (src[0] * 0x010101u);
+		return;
+	}
+}
+
+}
+
+bool Compositor::transparentSourceIsNoop(QPainter::CompositionMode mode)
+{
+	switch (mode) {
+	case QPainter::CompositionMode_Clear:
+	case QPainter::CompositionMode_Source:
+	case QPainter::CompositionMode_SourceIn:
+	case QPainter::CompositionMode_DestinationIn:
+	case QPainter::CompositionMode_SourceOut:
+	case QPainter::CompositionMode_DestinationAtop:
+		return false;
+	default:
+		return mode <= QPainter::CompositionMode_Exclusion;
+	}
+}
+
+int Compositor::bytesPerPixel(Format format)
+{
+	switch (format) {
+	case Format::ARGB32Premultiplied: return 4;
+	case Format::WhiteAlpha8: return 1;
+	case Format::GrayAlpha16: return 2;
+	}
+	Q_UNREACHABLE();
+}
+
+Compositor::Format Compositor::compactFormat(const QImage &image)
+{
+	Q_ASSERT(image.format() == QImage::Format_ARGB32_Premultiplied);
+	bool white = true;
+	for (int y = 0; y < image.height(); ++y) {
+		auto line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+		for (int x = 0; x < image.width(); ++x) {
+			auto p = line[x];
+			auto gray = p & 0xff;
+			if (((p >> 8) & 0xff) != gray || ((p >> 16) & 0xff) != gray)
+				return Format::ARGB32Premultiplied;
+			white = white && gray == qAlpha(p);
+		}
+	}
+	return white ? Format::WhiteAlpha8 : Format::GrayAlpha16;
+}
+
+QByteArray Compositor::toFormat(const QImage &image, Format format)
+{
+	Q_ASSERT(image.format() == QImage::Format_ARGB32_Premultiplied);
+	const int width = image.width();
+	const int bytes_per_line = width * bytesPerPixel(format);
+	QByteArray pixels(bytes_per_line * image.height(), Qt::Uninitialized);
+	for (int y = 0; y < image.height(); ++y) {
+		auto line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+		auto out = reinterpret_cast<uchar *>(pixels.data()) + y * bytes_per_line;
+		switch (format) {
+		case Format::ARGB32Premultiplied:
+			std::copy_n(line, width, reinterpret_cast<QRgb *>(out));
+			break;
+		case Format::WhiteAlpha8:
+			for (int x = 0; x < width; ++x)
+				out[x] = static_cast<uchar>(qAlpha(line[x]));
+			break;
+		case Format::GrayAlpha16:
+			for (int x = 0; x < width; ++x) {
+				out[2*x] = static_cast<uchar>(qBlue(line[x]));
+				out[2*x+1] = static_cast<uchar>(qAlpha(line[x]));
+			}
+			break;
+		}
+	}
+	return pixels;
+}
+
+QImage Compositor::toImage(const uchar *pixels, int bytes_per_line, const QSize &size, Format format)
+{
+	QImage image(size, QImage::Format_ARGB32_Premultiplied);
+	for (int y = 0; y < size.height(); ++y)
+		expandRow(format, pixels + y * bytes_per_line,
+		          reinterpret_cast<uint *>(image.scanLine(y)), size.width());
+	return image;
+}
+
+void Compositor::composite(QImage &dest, const QPoint &pos,
+                           const QImage &src, const QRect &src_rect,
+                           QPainter::CompositionMode mode)
+{
+	Q_ASSERT(dest.format() == QImage::Format_ARGB32_Premultiplied);
+	if (src.format() != QImage::Format_ARGB32_Premultiplied) {
+		composite(dest, pos, src.convertToFormat(QImage::Format_ARGB32_Premultiplied), src_rect, mode);
+		return;
+	}
+	// Clip the source rect to both images
+	auto source = src_rect.intersected(src.rect());
+	auto target = source.translated(pos - src_rect.topLeft()).intersected(dest.rect());
+	if (target.isEmpty())
+		return;
+	source = target.translated(src_rect.topLeft() - pos);
+	auto row = rowFunction(mode);
+	for (int y = 0; y < target.height(); ++y) {
+		auto dest_line = reinterpret_cast<uint *>(dest.scanLine(target.top() + y)) + target.left();
+		auto src_line = reinterpret_cast<const uint *>(src.constScanLine(source.top() + y)) + source.left();
+		row(dest_line, src_line, target.width());
+	}
+}
+
+void Compositor::composite(QImage &dest, const QPoint &pos, const QImage &src,
+                           QPainter::CompositionMode mode)
+{
+	composite(dest, pos, src, src.rect(), mode);
+}
+
+void Compositor::composite(QImage &dest, const QPoint &pos,
+                           const uchar *src, int bytes_per_line, const QSize &src_size, Format format,
+                           QPainter::CompositionMode mode)
+{
+	Q_ASSERT(dest.format() == QImage::Format_ARGB32_Premultiplied);
+	auto target = QRect(pos, src_size).intersected(dest.rect());
+	if (target.isEmpty())
+		return;
+	const auto offset = target.topLeft() - pos;
+	const int pixel_bytes = bytesPerPixel(format);
+	auto row = rowFunction(mode);
+	std::vector<uint> expanded(format == Format::ARGB32Premultiplied ? 0 : target.width());
+	for (int y = 0; y < target.height(); ++y) {
+		auto dest_line = reinterpret_cast<uint *>(dest.scanLine(target.top() + y)) + target.left();
+		auto src_line = src + (offset.y() + y) * bytes_per_line + offset.x() * pixel_bytes;
+		if (format == Format::ARGB32Premultiplied)
+			row(dest_line, reinterpret_cast<const uint *>(src_line), target.width());
+		else {
+			expandRow(format, src_line, expanded.data(), target.width());
+			row(dest_line, expanded.data(), target.width());
+		}
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <QImage>
+#include <QPainter>
+
+// Composition of premultiplied ARGB32 images without QPainter, so tiles can
+// be assembled without a paint device, from any thread.
+//
+// Every composition mode up to QPainter::CompositionMode_Exclusion is
+// supported, with the same integer arithmetic as the Qt raster engine so
+// that results match QPainter::drawImage at integer positions (see
+// tests/CompositorTest.cpp).
+// Source, SourceOver, DestinationIn, DestinationOut, Plus, Multiply and
+// Screen use SSE2 kernels when available.
+//
+// Sources may also be given as raw pixels in compact formats, for sheets
+// of white glyphs or gray art. Their rows are expanded one at a time while
+// compositing, with the same results as the equivalent ARGB32 source.
+class Compositor
+{
+public:
+	enum class Format
+	{
+		ARGB32Premultiplied,
+		WhiteAlpha8, // alpha of premultiplied white pixels
+		GrayAlpha16, // premultiplied gray and alpha bytes
+	};
+	static int bytesPerPixel(Format format);
+	// Most compact format representing a premultiplied ARGB32 image exactly
+	static Format compactFormat(const QImage &image);
+	// Pixels of a premultiplied ARGB32 image in format, which must be able to
+	// represent it, rows are contiguous.
+	static QByteArray toFormat(const QImage &image, Format format);
+	// Premultiplied ARGB32 image from pixels in format
+	static QImage toImage(const uchar *pixels, int bytes_per_line, const QSize &size, Format format);
+
+	// True if compositing a transparent source leaves the destination unchanged
+	static bool transparentSourceIsNoop(QPainter::CompositionMode mode);
+
+	// Draw src_rect of src at pos in dest, clipped to dest. Both images
+	// must use Format_ARGB32_Premultiplied.
+	static void composite(QImage &dest, const QPoint &pos,
+	                      const QImage &src, const QRect &src_rect,
+	                      QPainter::CompositionMode mode);
+	static void composite(QImage &dest, const QPoint &pos, const QImage &src,
+	                      QPainter::CompositionMode mode);
+	// Draw raw pixels of src_size in format, with rows bytes_per_line apart
+	static void composite(QImage &dest, const QPoint &pos,
+	                      const uchar *src, int bytes_per_line, const QSize &src_size, Format format,
+	                      QPainter::CompositionMode mode);
+};
+
+#endif // COMPOSITOR_H
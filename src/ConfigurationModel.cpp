@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "ConfigurationModel.h"
+
+#include <QFutureWatcher>
+#include <QSettings>
+#include <QtConcurrent>
+
+#include "IconCache.h"
+#include "Tileset.h"
+
+#include <QtDebug>
+
+ConfigurationModel::ConfigurationModel(QSettings &s, const std::vector<Tileset *> &tilesets, QObject *parent)
+        : QAbstractTableModel(parent)
+        , _tilesets(tilesets)
+{
+	bool ok;
+	int config_size = s.beginReadArray("item");
+	_items.reserve(static_cast<std::size_t>(config_size));
+	for (int i = 0; i < config_size; ++i) {
+		s.setArrayIndex(i);
+		auto name = s.value("name", tr("Unnamed setting")).toString();
+		auto tileset_index = s.value("tileset", 1).toUInt(&ok) - 1;
+		if (!ok || tileset_index >= tilesets.size()) {
+			qCritical().noquote() << tr("Invalid tileset index in %1").arg(s.group());
+			continue;
+		}
+		auto layer_index = s.value("layer").toUInt(&ok) - 1;
+		if (!ok || layer_index >= tilesets[tileset_index]->layers().size()) {
+			qCritical().noquote() << tr("Invalid layer index in %1").arg(s.group());
+			continue;
+		}
+		_items.push_back({ name, name.toCaseFolded(), tileset_index, layer_index });
+	}
+	s.endArray();
+
+	// Keep rows in sync when the same layer is selected from another configuration
+	std::set<unsigned int> used_tilesets;
+	for (const auto &item: _items)
+		used_tilesets.insert(item.tileset_index);
+	for (auto tileset_index: used_tilesets) {
+		connect(tilesets[tileset_index], &Tileset::tilesetUpdated, this, [this, tileset_index] () {
+			for (std::size_t row = 0; row < _items.size(); ++row) {
+				if (_items[row].tileset_index == tileset_index) {
+					auto changed = index(static_cast<int>(row), AlternativeColumn);
+					emit dataChanged(changed, changed);
+				}
+			}
+		});
+	}
+}
+
+int ConfigurationModel::rowCount(const QModelIndex &parent) const
+{
+	return parent.isValid() ? 0 : static_cast<int>(_items.size());
+}
+
+int ConfigurationModel::columnCount(const QModelIndex &parent) const
+{
+	return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant ConfigurationModel::data(const QModelIndex &index, int role) const
+{
+	if (!index.isValid())
+		return QVariant();
+	const auto &item = _items[static_cast<std::size_t>(index.row())];
+	const auto &layer = _tilesets[item.tileset_index]->layers()[item.layer_index];
+	switch (role) {
+	case Qt::DisplayRole:
+		if (index.column() == NameColumn)
+			return item.name;
+		else
+			return layer.alternatives[layer.current].name;
+	case Qt::EditRole:
+		if (index.column() == AlternativeColumn)
+			return layer.current;
+		break;
+	case Qt::DecorationRole:
+		if (index.column() == AlternativeColumn)
+			return icon(item, layer.current);
+		break;
+	case SearchRole:
+		return item.search_key;
+	case TilesetIndexRole:
+		return item.tileset_index;
+	case LayerIndexRole:
+		return item.layer_index;
+	case AlternativesRole: {
+		QStringList names;
+		for (const auto &alternative: layer.alternatives)
+			names.append(alternative.name);
+		return names;
+	}
+	default:
+		break;
+	}
+	return QVariant();
+}
+
+QVariant ConfigurationModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+	if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+		return QVariant();
+	switch (section) {
+	case NameColumn:
+		return tr("Item");
+	case AlternativeColumn:
+		return tr("Alternative");
+	default:
+		return QVariant();
+	}
+}
+
+Qt::ItemFlags ConfigurationModel::flags(const QModelIndex &index) const
+{
+	auto flags = QAbstractTableModel::flags(index);
+	if (index.isValid() && index.column() == AlternativeColumn)
+		flags |= Qt::ItemIsEditable;
+	return flags;
+}
+
+bool ConfigurationModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+	if (!index.isValid() || index.column() != AlternativeColumn || role != Qt::EditRole)
+		return false;
+	const auto &item = _items[static_cast<std::size_t>(index.row())];
+	auto tileset = _tilesets[item.tileset_index];
+	const auto &layer = tileset->layers()[item.layer_index];
+	bool ok;
+	auto alternative = value.toUInt(&ok);
+	if (!ok || alternative >= layer.alternatives.size())
+		return false;
+	if (alternative != layer.current) {
+		// tilesetUpdated refreshes every row using this layer
+		tileset->selectAlternative(item.layer_index, alternative);
+	}
+	return true;
+}
+
+QIcon ConfigurationModel::icon(const item_t &item, unsigned int alternative) const
+{
+	auto key = std::make_tuple(item.tileset_index, item.layer_index, alternative);
+	auto it = _icons.find(key);
+	if (it != _icons.end())
+		return it->second;
+	requestIcon(key);
+	return QIcon();
+}
+
+void ConfigurationModel::requestIcon(const icon_key_t &key) const
+{
+	if (!_requested_icons.insert(key).second)
+		return;
+	auto tileset = _tilesets[std::get<0>(key)];
+	const auto &alternative = tileset->layers()[std::get<1>(key)].alternatives[std::get<2>(key)];
+	if (alternative.sources.empty())
+		return;
+	auto self = const_cast<ConfigurationModel *>(this);
+	auto watcher = new QFutureWatcher<QImage>(self);
+	connect(watcher, &QFutureWatcher<QImage>::finished, self, [self, watcher, key] () {
+		auto icon = watcher->result();
+		if (!icon.isNull()) {
+			self->_icons.emplace(key, QIcon(QPixmap::fromImage(icon)));
+			self->iconChanged(std::get<0>(key), std::get<1>(key));
+		}
+		watcher->deleteLater();
+	});
+	watcher->setFuture(QtConcurrent::run([tileset, alternative = &alternative] () {
+		return IconCache::instance().icon(*tileset, *alternative);
+	}));
+}
+
+void ConfigurationModel::iconChanged(unsigned int tileset_index, unsigned int layer_index)
+{
+	for (std::size_t row = 0; row < _items.size(); ++row) {
+		const auto &item = _items[row];
+		if (item.tileset_index == tileset_index && item.layer_index == layer_index) {
+			auto changed = index(static_cast<int>(row), AlternativeColumn);
+			emit dataChanged(changed, changed);
+		}
+	}
+}
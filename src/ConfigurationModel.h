@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CONFIGURATION_MODEL_H
+#define CONFIGURATION_MODEL_H
+
+#include <QAbstractTableModel>
+#include <QIcon>
+
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+
+class QSettings;
+class Tileset;
+
+// Items of a configuration: one row per item, with its name and the
+// current alternative of the tileset layer it selects.
+//
+// Alternative icons are only rendered when a view asks for them, which a
+// view does for visible rows only.
+class ConfigurationModel: public QAbstractTableModel
+{
+	Q_OBJECT
+public:
+	enum Column
+	{
+		NameColumn = 0,
+		AlternativeColumn,
+		ColumnCount
+	};
+
+	enum Role
+	{
+		// Case folded item name, for filtering
+		SearchRole = Qt::UserRole,
+		TilesetIndexRole,
+		LayerIndexRole,
+		// Names of every alternative of the item layer
+		AlternativesRole,
+	};
+
+	ConfigurationModel(QSettings &s, const std::vector<Tileset *> &tilesets, QObject *parent = nullptr);
+
+	int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+	int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+	QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+	QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+	Qt::ItemFlags flags(const QModelIndex &index) const override;
+	// Selects alternative value (an int) for the item at index
+	bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
+
+private:
+	struct item_t
+	{
+		QString name, search_key;
+		unsigned int tileset_index, layer_index;
+	};
+	using icon_key_t = std::tuple<unsigned int, unsigned int, unsigned int>; // tileset, layer, alternative
+
+	QIcon icon(const item_t &item, unsigned int alternative) const;
+	void requestIcon(const icon_key_t &key) const;
+	void iconChanged(unsigned int tileset_index, unsigned int layer_index);
+
+	std::vector<Tileset *> _tilesets;
+	std::vector<item_t> _items;
+	mutable std::map<icon_key_t, QIcon> _icons;
+	mutable std::set<icon_key_t> _requested_icons;
+};
+
+#endif // CONFIGURATION_MODEL_H
@@ -16,92 +16,112 @@
  */
 #include "ConfigurationWidget.h"
 
-#include <QComboBox>
-#include <QFormLayout>
-#include <QLabel>
+#include <QHeaderView>
+#include <QLineEdit>
 #include <QMouseEvent>
 #include <QScrollBar>
-#include <QSettings>
+#include <QSortFilterProxyModel>
+#include <QTreeView>
+#include <QVBoxLayout>
 
-#include "Tileset.h"
-#include "TileSubset.h"
-
-#include <QtDebug>
+#include "AlternativeComboBox.h"
+#include "AlternativeDelegate.h"
+#include "ConfigurationModel.h"
 
 ConfigurationWidget::ConfigurationWidget(QSettings &s, const std::vector<Tileset *> &tilesets, QWidget *parent)
-        : QScrollArea(parent)
-        , _layout(new QFormLayout(this))
-        , _current_widget(nullptr)
+        : QWidget(parent)
+        , _model(new ConfigurationModel(s, tilesets, this))
+        , _filter(new QSortFilterProxyModel(this))
+        , _view(new QTreeView(this))
 {
-	setWidgetResizable(true);
-	setSizeAdjustPolicy(QAbstractScrollArea::AdjustToContents);
-	setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
-	setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
 	setSizePolicy(QSizePolicy::Minimum, QSizePolicy::Expanding);
 
-	auto widget = new QWidget(this);
+	// Names are case folded once by the model, filter strings are folded the same way
+	_filter->setSourceModel(_model);
+	_filter->setFilterRole(ConfigurationModel::SearchRole);
+	_filter->setFilterKeyColumn(ConfigurationModel::NameColumn);
+	_filter->setFilterCaseSensitivity(Qt::CaseSensitive);
 
-	bool ok;
-	int config_size = s.beginReadArray("item");
-	for (int i = 0; i < config_size; ++i) {
-		s.setArrayIndex(i);
-		auto name = s.value("name", tr("Unnamed setting")).toString();
-		auto tileset_index = s.value("tileset", 1).toUInt(&ok) - 1;
-		if (!ok || tileset_index >= tilesets.size()) {
-			qCritical().noquote() << tr("Invalid tileset index in %1").arg(s.group());
-			continue;
-		}
-		auto tileset = tilesets[tileset_index];
-		auto layer_index = s.value("layer").toUInt(&ok) - 1;
-		if (!ok || layer_index >= tileset->layers().size()) {
-			qCritical().noquote() << tr("Invalid layer index in %1").arg(s.group());
-			continue;
-		}
-		const auto &layer = tileset->layers()[layer_index];
-		auto label = new QLabel(name, this);
-		auto combobox = new QComboBox(this);
-		for (unsigned int i = 0; i < layer.alternatives.size(); ++i) {
-			const auto &alternative = layer.alternatives[i];
-			auto icon = tileset->renderAlternativeIcon(alternative);
-			if (icon.isNull())
-				combobox->addItem(alternative.name, i);
-			else
-				combobox->addItem(QIcon(icon), alternative.name, i);
-		}
-		for (auto widget: { static_cast<QWidget *>(label), static_cast<QWidget *>(combobox) }) {
-			widget->setMouseTracking(true);
-			_highlights.emplace(std::piecewise_construct,
-			                    std::forward_as_tuple(widget),
-			                    std::forward_as_tuple(tileset_index, layer.tiles));
-		}
-		connect(combobox, qOverload<int>(&QComboBox::currentIndexChanged), [tileset, layer_index] (int index) {
-			if (index >= 0)
-				tileset->selectAlternative(layer_index, static_cast<unsigned>(index));
-		});
-		_layout->addRow(label, combobox);
-	}
-	s.endArray();
+	auto filter_edit = new QLineEdit(this);
+	filter_edit->setPlaceholderText(tr("Filter items"));
+	filter_edit->setClearButtonEnabled(true);
+	connect(filter_edit, &QLineEdit::textChanged, this, &ConfigurationWidget::setFilter);
+
+	_view->setModel(_filter);
+	_view->setItemDelegateForColumn(ConfigurationModel::AlternativeColumn, new AlternativeDelegate(tilesets, this));
+	_view->setRootIsDecorated(false);
+	_view->setUniformRowHeights(true);
+	_view->setAllColumnsShowFocus(true);
+	_view->setSelectionMode(QAbstractItemView::NoSelection);
+	_view->setEditTriggers(QAbstractItemView::EditKeyPressed);
+	_view->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+	_view->setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
+	_view->header()->hide();
+	_view->header()->setStretchLastSection(true);
+	_view->resizeColumnToContents(ConfigurationModel::NameColumn);
+	_view->resizeColumnToContents(ConfigurationModel::AlternativeColumn);
+	_view->setMouseTracking(true);
+	_view->viewport()->installEventFilter(this);
+	connect(_view, &QAbstractItemView::entered, this, &ConfigurationWidget::highlight);
+	// A single click opens the alternative list, as it would on a combo box
+	connect(_view, &QAbstractItemView::clicked, this, [this] (const QModelIndex &index) {
+		if (index.column() != ConfigurationModel::AlternativeColumn)
+			return;
+		if (!_view->indexWidget(index))
+			_view->edit(index);
+		if (auto combobox = qobject_cast<AlternativeComboBox *>(_view->indexWidget(index)))
+			combobox->showPopup();
+	});
+
+	auto layout = new QVBoxLayout(this);
+	layout->setContentsMargins(0, 0, 0, 0);
+	layout->addWidget(filter_edit);
+	layout->addWidget(_view);
 
-	widget->setLayout(_layout);
-	widget->setMouseTracking(true);
-	setWidget(widget);
-	setMouseTracking(true);
-	setMinimumWidth(widget->sizeHint().width() + verticalScrollBar()->width());
+	int width = _view->frameWidth() * 2 + _view->verticalScrollBar()->sizeHint().width();
+	for (int column = 0; column < ConfigurationModel::ColumnCount; ++column)
+		width += _view->columnWidth(column);
+	setMinimumWidth(width);
 }
 
-void ConfigurationWidget::mouseMoveEvent(QMouseEvent *event)
+void ConfigurationWidget::setFrameShape(QFrame::Shape shape)
 {
-	QWidget::mouseMoveEvent(event);
+	_view->setFrameShape(shape);
+}
 
-	auto pos = event->localPos();
-	auto widget = childAt(static_cast<int>(pos.x()), static_cast<int>(pos.y()));
-	if (widget == _current_widget)
+void ConfigurationWidget::setFilter(const QString &text)
+{
+	_filter->setFilterFixedString(text.toCaseFolded());
+}
+
+bool ConfigurationWidget::eventFilter(QObject *watched, QEvent *event)
+{
+	if (watched == _view->viewport()) {
+		switch (event->type()) {
+		case QEvent::MouseMove:
+			// entered is not emitted when moving out of the rows
+			if (!_view->indexAt(static_cast<QMouseEvent *>(event)->pos()).isValid())
+				highlight(QModelIndex());
+			break;
+		case QEvent::Leave:
+			highlight(QModelIndex());
+			break;
+		default:
+			break;
+		}
+	}
+	return QWidget::eventFilter(watched, event);
+}
+
+void ConfigurationWidget::highlight(const QModelIndex &index)
+{
+	auto row = index.sibling(index.row(), ConfigurationModel::NameColumn);
+	if (row == _highlighted)
 		return;
-	else
-		_current_widget = widget;
-	auto it = _highlights.find(widget);
-	if (it != _highlights.end())
-		emit highlightTiles(it->second.first, it->second.second);
+	_highlighted = row;
+	if (row.isValid())
+		emit highlightTiles(row.data(ConfigurationModel::TilesetIndexRole).toUInt(),
+		                    row.data(ConfigurationModel::LayerIndexRole).toUInt());
 	else
 		emit clearHighlightedTiles();
 }
@@ -17,32 +17,46 @@
 #ifndef CONFIGURATION_WIDGET_H
 #define CONFIGURATION_WIDGET_H
 
-#include <QScrollArea>
+#include <QFrame>
+#include <QPersistentModelIndex>
+
+#include <vector>
 
-class QFormLayout;
 class QSettings;
+class QSortFilterProxyModel;
+class QTreeView;
+class ConfigurationModel;
 class Tileset;
-class TileSubset;
 
-class ConfigurationWidget: public QScrollArea
+// List of the configuration items with a filter on their names.
+//
+// Items are rows of a view, so packs with hundreds of items only create
+// widgets for the item being edited.
+class ConfigurationWidget: public QWidget
 {
 	Q_OBJECT
 public:
 	explicit ConfigurationWidget(QSettings &s, const std::vector<Tileset *> &tilesets, QWidget *parent = nullptr);
 
+	void setFrameShape(QFrame::Shape shape);
+
 signals:
-	void highlightTiles(unsigned int tileset_index, const TileSubset &tiles);
+	void highlightTiles(unsigned int tileset_index, unsigned int layer_index);
 	void clearHighlightedTiles();
 
 public slots:
+	void setFilter(const QString &text);
 
 protected:
-	void mouseMoveEvent(QMouseEvent *event) override;
+	bool eventFilter(QObject *watched, QEvent *event) override;
 
 private:
-	QFormLayout *_layout;
-	const QWidget *_current_widget;
-	std::map<const QWidget *, std::pair<unsigned int, TileSubset>> _highlights;
+	void highlight(const QModelIndex &index);
+
+	ConfigurationModel *_model;
+	QSortFilterProxyModel *_filter;
+	QTreeView *_view;
+	QPersistentModelIndex _highlighted;
 };
 
 #endif // CONFIGURATION_WIDGET_H
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "DeferredWidget.h"
+
+#include <QVBoxLayout>
+
+DeferredWidget::DeferredWidget(std::function<QWidget *()> factory, QWidget *parent)
+        : QWidget(parent)
+        , _factory(std::move(factory))
+{
+	auto layout = new QVBoxLayout(this);
+	layout->setContentsMargins(0, 0, 0, 0);
+}
+
+void DeferredWidget::showEvent(QShowEvent *event)
+{
+	QWidget::showEvent(event);
+	if (!_factory)
+		return;
+	auto factory = std::move(_factory);
+	_factory = nullptr;
+	if (auto widget = factory())
+		layout()->addWidget(widget);
+}
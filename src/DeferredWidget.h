@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef DEFERRED_WIDGET_H
+#define DEFERRED_WIDGET_H
+
+#include <QWidget>
+
+#include <functional>
+
+// Placeholder creating its content the first time it is shown, so that
+// background tabs cost nothing until the user opens them.
+class DeferredWidget: public QWidget
+{
+	Q_OBJECT
+public:
+	// factory may return nullptr if the content cannot be created
+	explicit DeferredWidget(std::function<QWidget *()> factory, QWidget *parent = nullptr);
+
+protected:
+	void showEvent(QShowEvent *event) override;
+
+private:
+	std::function<QWidget *()> _factory;
+};
+
+#endif // DEFERRED_WIDGET_H
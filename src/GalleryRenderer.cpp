@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "GalleryRenderer.h"
+
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QtConcurrent>
+
+#include <atomic>
+#include <memory>
+
+#include "Compositor.h"
+#include "IndexedPreview.h"
+#include "Pack.h"
+
+#include <QtDebug>
+
+GalleryRenderer::GalleryRenderer(const Pack &pack)
+        : _pack(pack)
+{
+}
+
+// "<index>-<name>" with only file name safe characters
+static QString fileName(unsigned int index, const QString &name)
+{
+	static const QRegularExpression unsafe("[^A-Za-z0-9_.-]+");
+	return QString("%1-%2").arg(index + 1).arg(QString(name).replace(unsafe, "_"));
+}
+
+static QString imageFileName(unsigned int palette, const QString &palette_name,
+                             unsigned int background, const QString &background_name)
+{
+	return fileName(palette, palette_name) + "--" + fileName(background, background_name) + ".png";
+}
+
+bool GalleryRenderer::render(const QString &output_dir) const
+{
+	const auto tilesets = _pack.constTilesetPointers();
+	const auto &previews = _pack.previews();
+	const auto &palettes = _pack.palettes();
+	const auto &backgrounds = _pack.backgrounds();
+
+	// Palette independent planes of each preview, rendered in parallel
+	std::vector<std::unique_ptr<IndexedPreview>> indexed(previews.size());
+	std::vector<unsigned int> preview_indices;
+	for (unsigned int i = 0; i < previews.size(); ++i) {
+		if (!previews[i].movie.isEmpty()) {
+			qWarning().noquote() << tr("Skipping movie preview %1").arg(previews[i].name);
+			continue;
+		}
+		indexed[i] = std::make_unique<IndexedPreview>(previews[i].preview, tilesets);
+		preview_indices.push_back(i);
+	}
+	QtConcurrent::blockingMap(preview_indices, [&indexed] (unsigned int i) {
+		indexed[i]->update();
+	});
+
+	struct job_t {
+		unsigned int preview, palette;
+		QString directory;
+	};
+	std::vector<job_t> jobs;
+	QJsonArray entries;
+	for (auto i: preview_indices) {
+		auto directory = QDir(output_dir).filePath(fileName(i, previews[i].name));
+		for (unsigned int p = 0; p < palettes.size(); ++p) {
+			jobs.push_back({ i, p, directory });
+			for (unsigned int b = 0; b < backgrounds.size(); ++b) {
+				QJsonObject entry;
+				entry["file"] = QDir(output_dir).relativeFilePath(QDir(directory).filePath(
+						imageFileName(p, palettes[p].first, b, backgrounds[b].first)));
+				entry["preview"] = previews[i].name;
+				entry["palette"] = palettes[p].first;
+				entry["background"] = backgrounds[b].first;
+				entries.append(entry);
+			}
+		}
+	}
+
+	// A job applies one palette, then saves an image for each background
+	std::atomic<bool> all_saved(true);
+	QtConcurrent::blockingMap(jobs, [&] (const job_t &job) {
+		if (!QDir().mkpath(job.directory)) {
+			qCritical().noquote() << tr("Failed to create %1").arg(job.directory);
+			all_saved = false;
+			return;
+		}
+		const auto &info = previews[job.preview].preview.info;
+		QImage colored(info.pixmapSize(), QImage::Format_ARGB32_Premultiplied);
+		indexed[job.preview]->apply(palettes[job.palette].second, colored);
+		for (unsigned int b = 0; b < backgrounds.size(); ++b) {
+			auto filename = QDir(job.directory).filePath(
+					imageFileName(job.palette, palettes[job.palette].first, b, backgrounds[b].first));
+			QImage image(info.pixmapSize(), QImage::Format_ARGB32_Premultiplied);
+			image.fill(backgrounds[b].second);
+			Compositor::composite(image, QPoint(), colored, QPainter::CompositionMode_SourceOver);
+			if (!image.save(filename)) {
+				qCritical().noquote() << tr("Failed to save %1").arg(filename);
+				all_saved = false;
+			}
+			else
+				qInfo().noquote() << tr("Saved %1").arg(filename);
+		}
+	});
+
+	auto index_path = QDir(output_dir).filePath("index.json");
+	QSaveFile index(index_path);
+	if (!QDir().mkpath(output_dir) || !index.open(QIODevice::WriteOnly) ||
+	    index.write(QJsonDocument(entries).toJson()) < 0 || !index.commit()) {
+		qCritical().noquote() << tr("Failed to write %1").arg(index_path);
+		return false;
+	}
+	return all_saved;
+}
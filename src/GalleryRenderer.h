@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef GALLERY_RENDERER_H
+#define GALLERY_RENDERER_H
+
+#include <QCoreApplication>
+
+class Pack;
+
+// Render every preview of a pack with every palette and background.
+//
+// Images are saved as <output_dir>/<preview>/<palette>--<background>.png
+// (names are prefixed with their index and made safe for file names), and
+// listed in <output_dir>/index.json. Each preview is rendered once in an
+// IndexedPreview, palettes and backgrounds are only applied to it. Movie
+// previews are skipped.
+class GalleryRenderer
+{
+	Q_DECLARE_TR_FUNCTIONS(GalleryRenderer)
+public:
+	explicit GalleryRenderer(const Pack &pack);
+
+	bool render(const QString &output_dir) const;
+
+private:
+	const Pack &_pack;
+};
+
+#endif // GALLERY_RENDERER_H
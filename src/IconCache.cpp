@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "IconCache.h"
+
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "PerfCounters.h"
+
+IconCache::IconCache()
+{
+	auto cache_location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+	if (!cache_location.isEmpty() && QDir().mkpath(cache_location + "/icons"))
+		_directory = cache_location + "/icons";
+}
+
+IconCache &IconCache::instance()
+{
+	static IconCache cache;
+	return cache;
+}
+
+QImage IconCache::icon(const Tileset &tileset, const Tileset::layer_t::alternative_t &alternative) const
+{
+	auto key = tileset.alternativeIconKey(alternative);
+	if (key.isEmpty())
+		return QImage();
+	QString filename;
+	if (!_directory.isEmpty()) {
+		filename = QString("%1/%2.png").arg(_directory).arg(QString::fromLatin1(key.toHex()));
+		QImage icon;
+		if (icon.load(filename)) {
+			PerfCounters::instance().addCacheAccess(PerfCounters::Cache::Icon, true);
+			return icon;
+		}
+	}
+	PerfCounters::instance().addCacheAccess(PerfCounters::Cache::Icon, false);
+	auto icon = tileset.renderAlternativeIcon(alternative);
+	if (!icon.isNull() && !filename.isEmpty()) {
+		QSaveFile file(filename);
+		if (file.open(QIODevice::WriteOnly) && icon.save(&file, "PNG"))
+			file.commit();
+	}
+	return icon;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef ICON_CACHE_H
+#define ICON_CACHE_H
+
+#include <QImage>
+#include <QString>
+
+#include "Tileset.h"
+
+// On-disk cache of alternative icons, keyed by Tileset::alternativeIconKey.
+// Thread-safe, meant to be used from worker threads.
+class IconCache
+{
+public:
+	static IconCache &instance();
+
+	QImage icon(const Tileset &tileset, const Tileset::layer_t::alternative_t &alternative) const;
+
+private:
+	IconCache();
+
+	QString _directory;
+};
+
+#endif // ICON_CACHE_H
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "IndexedPreview.h"
+
+#include <QPainter>
+
+#include <numeric>
+#include <tuple>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Palette.h"
+#include "Preview.h"
+
+IndexedPreview::IndexedPreview(const Preview &preview, const std::vector<const Tileset *> &tilesets)
+        : _preview(preview)
+        , _tilesets(tilesets)
+{
+}
+
+void IndexedPreview::update()
+{
+	const auto &info = _preview.info;
+	auto size = info.pixmapSize();
+	if (_base.size() != size) {
+		for (auto image: { &_base, &_fg_weight, &_bg_weight })
+			*image = QImage(size, QImage::Format_ARGB32_Premultiplied);
+	}
+	_fg_colors.assign(info.tileCount(), 0);
+	_bg_colors.assign(info.tileCount(), 0);
+	_mixed.assign(info.tileCount(), false);
+	std::vector<unsigned int> cells(info.tileCount());
+	std::iota(cells.begin(), cells.end(), 0);
+	update(cells);
+}
+
+void IndexedPreview::update(const std::vector<unsigned int> &cells)
+{
+	const auto &info = _preview.info;
+	const QColor black(Qt::black), white(Qt::white);
+	for (auto i: cells) {
+		bool first = true;
+		_mixed[i] = false;
+		for (unsigned int layer_index = 0; layer_index < _preview.layers.size(); ++layer_index) {
+			if (!_preview.drawsCell(layer_index, i))
+				continue;
+			const auto &layer = _preview.layers[layer_index];
+			if (first) {
+				_fg_colors[i] = layer.fg_colors[i];
+				_bg_colors[i] = layer.bg_colors[i];
+				first = false;
+			}
+			else if (_preview.use_colors &&
+			         (_fg_colors[i] != layer.fg_colors[i] || _bg_colors[i] != layer.bg_colors[i]))
+				_mixed[i] = true;
+		}
+	}
+	// Each probe is rendered with one batch per layer and tileset
+	for (const auto &t: { std::make_tuple(&_base, black, black),
+	                      std::make_tuple(&_fg_weight, white, black),
+	                      std::make_tuple(&_bg_weight, black, white) }) {
+		QPainter painter(std::get<0>(t));
+		painter.setCompositionMode(QPainter::CompositionMode_Source);
+		for (auto i: cells)
+			painter.fillRect(info.tileRect(i), Qt::transparent);
+		auto probe_colors = std::make_pair(std::get<1>(t), std::get<2>(t));
+		for (unsigned int layer_index = 0; layer_index < _preview.layers.size(); ++layer_index)
+			_preview.renderCells(painter, _tilesets, nullptr, layer_index, cells, [&probe_colors] (unsigned int) {
+				return probe_colors;
+			});
+	}
+
+	// Weights are what white probes added to the base
+	for (auto i: cells) {
+		auto rect = info.tileRect(i);
+		for (int y = rect.top(); y <= rect.bottom(); ++y) {
+			auto base_line = reinterpret_cast<const QRgb *>(_base.constScanLine(y)) + rect.left();
+			for (auto image: { &_fg_weight, &_bg_weight }) {
+				auto line = reinterpret_cast<QRgb *>(image->scanLine(y)) + rect.left();
+				for (int x = 0; x < rect.width(); ++x) {
+					auto b = base_line[x], p = line[x];
+					line[x] = qRgba(std::max(0, qRed(p) - qRed(b)),
+					                std::max(0, qGreen(p) - qGreen(b)),
+					                std::max(0, qBlue(p) - qBlue(b)),
+					                0);
+				}
+			}
+		}
+	}
+}
+
+void IndexedPreview::apply(const Palette &palette, QImage &image) const
+{
+	std::vector<unsigned int> mixed;
+	_preview.info.forEachTile([&] (unsigned int i, const QRect &rect) {
+		if (_mixed[i])
+			mixed.push_back(i);
+		else
+			applyCell(palette, image, i, rect);
+	});
+	renderMixed(palette, image, mixed);
+}
+
+void IndexedPreview::apply(const Palette &palette, QImage &image, const std::vector<unsigned int> &cells) const
+{
+	std::vector<unsigned int> mixed;
+	for (auto i: cells) {
+		if (_mixed[i])
+			mixed.push_back(i);
+		else
+			applyCell(palette, image, i, _preview.info.tileRect(i));
+	}
+	renderMixed(palette, image, mixed);
+}
+
+static inline int blend(int base, int fg_weight, int fg, int bg_weight, int bg, int alpha)
+{
+	return std::min(alpha, base + (fg_weight * fg + bg_weight * bg + 127) / 255);
+}
+
+// Same result as blend on every channel of count pixels
+static void applyRow(const QRgb *base, const QRgb *fg_weight, const QRgb *bg_weight, QRgb *out, int count,
+                     QRgb fg, QRgb bg)
+{
+	const int fg_r = qRed(fg), fg_g = qGreen(fg), fg_b = qBlue(fg);
+	const int bg_r = qRed(bg), bg_g = qGreen(bg), bg_b = qBlue(bg);
+	int x = 0;
+#ifdef __SSE2__
+	// Weighted sums are computed in 32 bits with madd, then clamped to 16 bits:
+	// sums that large are always clamped to alpha by the min.
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i colors = _mm_set_epi16(0, 0, static_cast<short>(bg_r), static_cast<short>(fg_r),
+	                                     static_cast<short>(bg_g), static_cast<short>(fg_g),
+	                                     static_cast<short>(bg_b), static_cast<short>(fg_b));
+	const __m128i rounding = _mm_set1_epi32(127 - 32768);
+	const __m128i sign = _mm_set1_epi16(static_cast<short>(0x8000));
+	const __m128i div255 = _mm_set1_epi16(static_cast<short>(0x8081)); // x/255 == (x*0x8081) >> 23
+	auto weighted = [&] (__m128i fg_weight16, __m128i bg_weight16) {
+		// kf and kb interleaved, one pixel per madd
+		auto lo = _mm_madd_epi16(_mm_unpacklo_epi16(fg_weight16, bg_weight16), colors);
+		auto hi = _mm_madd_epi16(_mm_unpackhi_epi16(fg_weight16, bg_weight16), colors);
+		auto sums = _mm_xor_si128(_mm_packs_epi32(_mm_add_epi32(lo, rounding), _mm_add_epi32(hi, rounding)), sign);
+		return _mm_srli_epi16(_mm_mulhi_epu16(sums, div255), 7);
+	};
+	auto blend2 = [&] (__m128i base16, __m128i quotients) {
+		auto alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(base16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		return _mm_min_epi16(_mm_add_epi16(base16, quotients), alpha);
+	};
+	for (; x + 4 <= count; x += 4) {
+		auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(base + x));
+		auto kf = _mm_loadu_si128(reinterpret_cast<const __m128i *>(fg_weight + x));
+		auto kb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bg_weight + x));
+		auto lo = blend2(_mm_unpacklo_epi8(b, zero),
+		                 weighted(_mm_unpacklo_epi8(kf, zero), _mm_unpacklo_epi8(kb, zero)));
+		auto hi = blend2(_mm_unpackhi_epi8(b, zero),
+		                 weighted(_mm_unpackhi_epi8(kf, zero), _mm_unpackhi_epi8(kb, zero)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; x < count; ++x) {
+		auto b = base[x], kf = fg_weight[x], kb = bg_weight[x];
+		int a = qAlpha(b);
+		out[x] = qRgba(blend(qRed(b), qRed(kf), fg_r, qRed(kb), bg_r, a),
+		               blend(qGreen(b), qGreen(kf), fg_g, qGreen(kb), bg_g, a),
+		               blend(qBlue(b), qBlue(kf), fg_b, qBlue(kb), bg_b, a),
+		               a);
+	}
+}
+
+qint64 IndexedPreview::memoryBytes() const
+{
+	qint64 bytes = 0;
+	for (auto image: { &_base, &_fg_weight, &_bg_weight })
+		bytes += image->sizeInBytes();
+	bytes += static_cast<qint64>(_fg_colors.size() + _bg_colors.size() + _mixed.size() / 8);
+	return bytes;
+}
+
+void IndexedPreview::renderMixed(const Palette &palette, QImage &image, const std::vector<unsigned int> &cells) const
+{
+	if (cells.empty())
+		return;
+	QPainter painter(&image);
+	painter.setCompositionMode(QPainter::CompositionMode_Source);
+	for (auto i: cells)
+		painter.fillRect(_preview.info.tileRect(i), Qt::transparent);
+	for (unsigned int layer_index = 0; layer_index < _preview.layers.size(); ++layer_index)
+		_preview.renderCells(painter, _tilesets, nullptr, layer_index, cells, [&] (unsigned int i) {
+			return _preview.cellColors(palette, layer_index, i);
+		});
+}
+
+void IndexedPreview::applyCell(const Palette &palette, QImage &image, unsigned int i, const QRect &rect) const
+{
+	auto fg = palette.colors[_fg_colors[i]].rgb();
+	auto bg = palette.colors[_bg_colors[i]].rgb();
+	for (int y = rect.top(); y <= rect.bottom(); ++y) {
+		auto base = reinterpret_cast<const QRgb *>(_base.constScanLine(y)) + rect.left();
+		auto fg_weight = reinterpret_cast<const QRgb *>(_fg_weight.constScanLine(y)) + rect.left();
+		auto bg_weight = reinterpret_cast<const QRgb *>(_bg_weight.constScanLine(y)) + rect.left();
+		auto out = reinterpret_cast<QRgb *>(image.scanLine(y)) + rect.left();
+		applyRow(base, fg_weight, bg_weight, out, rect.width(), fg, bg);
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INDEXED_PREVIEW_H
+#define INDEXED_PREVIEW_H
+
+#include <QImage>
+
+#include <vector>
+
+class Palette;
+class Preview;
+class Tileset;
+
+// Palette independent rendering of a preview.
+//
+// Cells are rendered once with probe colors, keeping for each pixel a base
+// color and the weights of the foreground and background colors:
+//
+//     pixel = base + fg_weight * fg + bg_weight * bg
+//
+// so that applying a palette is a single arithmetic pass using the color
+// indices of each cell. Cells whose layers use different color pairs do not
+// fit this model and are rendered directly with the palette instead.
+class IndexedPreview
+{
+public:
+	// preview must outlive this object
+	IndexedPreview(const Preview &preview, const std::vector<const Tileset *> &tilesets);
+
+	// Render the planes again, for all cells or only the given ones
+	void update();
+	void update(const std::vector<unsigned int> &cells);
+
+	// Write the colored cells in image, it must have the preview size
+	void apply(const Palette &palette, QImage &image) const;
+	void apply(const Palette &palette, QImage &image, const std::vector<unsigned int> &cells) const;
+
+	// Size of the planes and cell data
+	qint64 memoryBytes() const;
+
+private:
+	// Arithmetic pass for a cell that is not mixed
+	void applyCell(const Palette &palette, QImage &image, unsigned int i, const QRect &rect) const;
+	// Render mixed cells directly with the palette
+	void renderMixed(const Palette &palette, QImage &image, const std::vector<unsigned int> &cells) const;
+
+	const Preview &_preview;
+	std::vector<const Tileset *> _tilesets;
+	QImage _base, _fg_weight, _bg_weight;
+	// color pair used by each cell, unless it is mixed
+	std::vector<uint8_t> _fg_colors, _bg_colors;
+	std::vector<bool> _mixed;
+};
+
+#endif // INDEXED_PREVIEW_H
@@ -16,8 +16,17 @@
  */
 #include "LogWindow.h"
 
+#include <QApplication>
+#include <QClipboard>
+#include <QFileInfo>
+#include <QThread>
+#include <QTimer>
+
 #include <iostream>
 
+#include "PerfCounters.h"
+#include "Tileset.h"
+
 LogWindow::LogWindow(QWidget *parent)
         : QWidget(parent)
         , _warning_count(0)
@@ -31,6 +40,12 @@ LogWindow::LogWindow(QWidget *parent)
 	QImage warning(":img/warning");
 	doc->addResource(QTextDocument::ImageResource, QUrl("img://error"), QVariant(error));
 	doc->addResource(QTextDocument::ImageResource, QUrl("img://warning"), QVariant(warning));
+
+	// Counters are only read while the performance tab is shown
+	_performance_timer = new QTimer(this);
+	_performance_timer->setInterval(500);
+	connect(_performance_timer, &QTimer::timeout, this, &LogWindow::updatePerformance);
+	_performance_timer->start();
 }
 
 LogWindow *LogWindow::_window = nullptr;
@@ -45,6 +60,13 @@ LogWindow *LogWindow::instance()
 void LogWindow::handleMessage(QtMsgType type, const QMessageLogContext &context, const QString &message)
 {
 	std::cerr << message.toLocal8Bit().data() << std::endl;
+	if (QThread::currentThread() != QCoreApplication::instance()->thread()) {
+		// messages from worker threads are added from the GUI thread
+		QMetaObject::invokeMethod(QCoreApplication::instance(), [type, message] () {
+			instance()->addMessage(type, QMessageLogContext(), message);
+		}, Qt::QueuedConnection);
+		return;
+	}
 	instance()->addMessage(type, context, message);
 }
 
@@ -85,3 +107,82 @@ void LogWindow::addMessage(QtMsgType type, const QMessageLogContext &, const QSt
 	if (type >= QtCriticalMsg)
 		show();
 }
+
+void LogWindow::setTilesets(const std::vector<const Tileset *> &tilesets)
+{
+	_tilesets = tilesets;
+}
+
+static QString formatDuration(qint64 nsecs)
+{
+	return LogWindow::tr("%1 ms").arg(nsecs / 1e6, 0, 'f', 2);
+}
+
+static QString formatBytes(qint64 bytes)
+{
+	return LogWindow::tr("%1 MiB").arg(bytes / (1024.0 * 1024.0), 0, 'f', 1);
+}
+
+void LogWindow::updatePerformance()
+{
+	if (!isVisible() || tabs->currentWidget() != performance_tab)
+		return;
+	const auto &counters = PerfCounters::instance();
+	performance->clear();
+
+	auto timings = new QTreeWidgetItem(performance, { tr("Timings") });
+	for (unsigned int i = 0; i < static_cast<unsigned int>(PerfCounters::Stage::Count); ++i) {
+		auto stage = static_cast<PerfCounters::Stage>(i);
+		auto timing = counters.timing(stage);
+		new QTreeWidgetItem(timings, {
+			PerfCounters::stageName(stage),
+			timing.count == 0
+				? tr("no sample")
+				: tr("last %1, p50 %2, p95 %3 (%4 samples)")
+				  .arg(formatDuration(timing.last))
+				  .arg(formatDuration(timing.p50))
+				  .arg(formatDuration(timing.p95))
+				  .arg(timing.count)
+		});
+	}
+
+	auto caches = new QTreeWidgetItem(performance, { tr("Caches") });
+	for (unsigned int i = 0; i < static_cast<unsigned int>(PerfCounters::Cache::Count); ++i) {
+		auto cache = static_cast<PerfCounters::Cache>(i);
+		auto hits = counters.cacheHits(cache);
+		auto total = hits + counters.cacheMisses(cache);
+		new QTreeWidgetItem(caches, {
+			PerfCounters::cacheName(cache),
+			total == 0
+				? tr("no access")
+				: tr("%1% hits (%2 of %3)")
+				  .arg(100.0 * hits / total, 0, 'f', 1)
+				  .arg(hits)
+				  .arg(total)
+		});
+	}
+
+	auto memory = new QTreeWidgetItem(performance, { tr("Memory") });
+	for (auto tileset: _tilesets)
+		new QTreeWidgetItem(memory, {
+			QFileInfo(tileset->outputs().front()).fileName(),
+			formatBytes(tileset->decodedBytes())
+		});
+	new QTreeWidgetItem(memory, { tr("Previews"), formatBytes(counters.previewBytes()) });
+
+	performance->expandAll();
+	performance->resizeColumnToContents(0);
+}
+
+void LogWindow::on_copy_performance_button_clicked()
+{
+	updatePerformance();
+	QStringList lines;
+	for (int i = 0; i < performance->topLevelItemCount(); ++i) {
+		auto section = performance->topLevelItem(i);
+		lines.append(section->text(0));
+		for (int j = 0; j < section->childCount(); ++j)
+			lines.append(QString("  %1: %2").arg(section->child(j)->text(0)).arg(section->child(j)->text(1)));
+	}
+	QApplication::clipboard()->setText(lines.join('\n'));
+}
@@ -19,8 +19,13 @@
 
 #include <QWidget>
 
+#include <vector>
+
 #include "ui_LogWindow.h"
 
+class QTimer;
+class Tileset;
+
 class LogWindow: public QWidget, private Ui::LogWindow
 {
 	Q_OBJECT
@@ -33,18 +38,25 @@ public:
 	unsigned int warningCount() const;
 	unsigned int errorCount() const;
 
+	// Tilesets whose memory is shown in the performance tab
+	void setTilesets(const std::vector<const Tileset *> &tilesets);
+
 signals:
 	void errorCountChanged(unsigned int errors, unsigned int warnings);
 
 public slots:
+	void on_copy_performance_button_clicked();
 
 private:
 	static LogWindow *_window;
 
 	void addMessage(QtMsgType, const QMessageLogContext &, const QString &);
+	void updatePerformance();
 
 	unsigned int _warning_count;
 	unsigned int _error_count;
+	std::vector<const Tileset *> _tilesets;
+	QTimer *_performance_timer;
 };
 
 #endif // LOG_WINDOW_H
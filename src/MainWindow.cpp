@@ -26,23 +26,17 @@
 #include <QMessageBox>
 #include <QScrollBar>
 #include <QTableWidget>
+#include <QThreadPool>
 
 #include <QtDebug>
 
+#include "CMVReader.h"
 #include "ConfigurationWidget.h"
+#include "DeferredWidget.h"
+#include "Pack.h"
+#include "PerfCounters.h"
 #include "PreviewWidget.h"
 #include "Tileset.h"
-#include "Palette.h"
-
-template<typename T, typename U>
-static std::vector<T *> ptr_vec(const std::vector<std::unique_ptr<U>> &vec)
-{
-	std::vector<T *> out;
-	out.reserve(vec.size());
-	for (const auto &ptr: vec)
-		out.push_back(ptr.get());
-	return out;
-}
 
 MainWindow::MainWindow(const QString &config_path, QWidget *parent)
         : QMainWindow(parent)
@@ -84,20 +78,17 @@ MainWindow::MainWindow(const QString &config_path, QWidget *parent)
 	_about_dialog = std::make_unique<AboutDialog>(settings, this);
 	_about_dialog->adjustSize();
 
-	// Create tilesets
-	auto tileset_count = settings.beginReadArray("tilesets");
-	for (int i = 0; i < tileset_count; ++i) {
-		settings.setArrayIndex(i);
-		_tilesets.emplace_back(std::make_unique<Tileset>(settings));
-	}
-	settings.endArray();
+	// Load tilesets, colors and previews
+	_pack = std::make_unique<Pack>(config_path);
+	_pack->tilePool().logStatistics();
+	LogWindow::instance()->setTilesets(_pack->constTilesetPointers());
 
 	// Create Configuration widgets
 	std::vector<ConfigurationWidget *> conf_widgets;
 	int conf_tab_count = settings.beginReadArray("configuration");
 	if (conf_tab_count == 1) {
 		settings.setArrayIndex(0);
-		auto conf_widget = new ConfigurationWidget(settings, ptr_vec<Tileset>(_tilesets), central_widget);
+		auto conf_widget = new ConfigurationWidget(settings, _pack->tilesetPointers(), central_widget);
 		conf_widgets.push_back(conf_widget);
 		layout->addWidget(conf_widget);
 	}
@@ -106,7 +97,7 @@ MainWindow::MainWindow(const QString &config_path, QWidget *parent)
 		tabs->setSizePolicy(QSizePolicy::Minimum, QSizePolicy::MinimumExpanding);
 		for (int i = 0; i < conf_tab_count; ++i) {
 			settings.setArrayIndex(i);
-			auto conf_widget = new ConfigurationWidget(settings, ptr_vec<Tileset>(_tilesets), central_widget);
+			auto conf_widget = new ConfigurationWidget(settings, _pack->tilesetPointers(), central_widget);
 			conf_widgets.push_back(conf_widget);
 			conf_widget->setFrameShape(QFrame::NoFrame);
 			tabs->addTab(conf_widget, settings.value("name", tr("Unnamed tab")).toString());
@@ -116,99 +107,62 @@ MainWindow::MainWindow(const QString &config_path, QWidget *parent)
 	}
 	settings.endArray();
 
-	// Load palettes and colors
-	settings.beginGroup("colors");
-	int palette_count = settings.beginReadArray("palette");
-	for (int i = 0; i < palette_count; ++i) {
-		settings.setArrayIndex(i);
-		auto name = settings.value("name", tr("Unnamed palette")).toString();
-		QFile file(settings.value("file").toString());
-		if (!file.open(QIODevice::ReadOnly)) {
-			qCritical().noquote() << tr("Cannot open palette: %1").arg(file.fileName());
-			continue;
-		}
-		_palettes.emplace_back(name, &file);
-	}
-	settings.endArray();
-	if (_palettes.empty())
-		_palettes.emplace_back(tr("Default palette"), Palette());
-	int bg_count = settings.beginReadArray("background");
-	for (int i = 0; i < bg_count; ++i) {
-		settings.setArrayIndex(i);
-		auto name = settings.value("name", tr("Unnamed background color")).toString();
-		auto color = settings.value("color").toString();
-		_backgrounds.emplace_back(name, color);
-	}
-	settings.endArray();
-	if (_backgrounds.empty())
-		_backgrounds.emplace_back(tr("Default background"),
-		                          QPalette().color(QPalette::Base));
-	int outline_count = settings.beginReadArray("outline");
-	for (int i = 0; i < outline_count; ++i) {
-		settings.setArrayIndex(i);
-		auto name = settings.value("name", tr("Unnamed outline color")).toString();
-		auto color = settings.value("color").toString();
-		_outlines.emplace_back(name, color);
-	}
-	settings.endArray();
-	if (_outlines.empty())
-		_outlines.emplace_back(tr("Red"), Qt::red);
-	settings.endGroup();
-
 	// Create previews
 	auto tabs = new QTabWidget(central_widget);
 	tabs->setSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::MinimumExpanding);
-	int preview_count = settings.beginReadArray("previews");
-	for (int i = 0; i < preview_count; ++i) {
-		settings.setArrayIndex(i);
-		auto name = settings.value("name", tr("Unnamed Preview")).toString();
-		QFile file(settings.value("file").toString());
-		if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-			qCritical().noquote() << tr("Failed to open preview file: %1").arg(file.fileName());
-			continue;
-		}
-		try {
-			auto scroll_area = new QScrollArea;
-			scroll_area->setWidgetResizable(true);
-			scroll_area->setSizeAdjustPolicy(QAbstractScrollArea::AdjustToContents);
-			scroll_area->setSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::MinimumExpanding);
-			scroll_area->setFrameShape(QFrame::NoFrame);
-			auto preview = new PreviewWidget(ptr_vec<const Tileset>(_tilesets), &file, _palettes, _backgrounds, _outlines);
-			preview->setSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::MinimumExpanding);
-			for (auto conf_widget: conf_widgets) {
-				connect(conf_widget, &ConfigurationWidget::highlightTiles,
-				        preview, &PreviewWidget::setHighlight);
-				connect(conf_widget, &ConfigurationWidget::clearHighlightedTiles,
-				        preview, &PreviewWidget::clearHighlight);
+	for (const auto &p: _pack->previews()) {
+		// Previews are only created when their tab is first shown
+		auto factory = [this, &p, conf_widgets] () -> QWidget * {
+			try {
+				PreviewWidget *preview;
+				if (!p.movie.isEmpty())
+					preview = new PreviewWidget(_pack->constTilesetPointers(),
+					                            std::make_unique<CMVReader>(p.movie),
+					                            _pack->palettes(), _pack->backgrounds(), _pack->outlines());
+				else
+					preview = new PreviewWidget(_pack->constTilesetPointers(), p.preview,
+					                            _pack->palettes(), _pack->backgrounds(), _pack->outlines());
+				auto scroll_area = new QScrollArea;
+				scroll_area->setWidgetResizable(true);
+				scroll_area->setSizeAdjustPolicy(QAbstractScrollArea::AdjustToContents);
+				scroll_area->setSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::MinimumExpanding);
+				scroll_area->setFrameShape(QFrame::NoFrame);
+				preview->setSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::MinimumExpanding);
+				for (auto conf_widget: conf_widgets) {
+					connect(conf_widget, &ConfigurationWidget::highlightTiles,
+					        preview, &PreviewWidget::setHighlight);
+					connect(conf_widget, &ConfigurationWidget::clearHighlightedTiles,
+					        preview, &PreviewWidget::clearHighlight);
+				}
+				scroll_area->setHorizontalScrollBarPolicy(preview->info().tilemapWidth() > 16
+				                                          ? Qt::ScrollBarAlwaysOn
+				                                          : Qt::ScrollBarAlwaysOff);
+				scroll_area->setVerticalScrollBarPolicy(preview->info().tilemapHeight() > 16
+				                                        ? Qt::ScrollBarAlwaysOn
+				                                        : Qt::ScrollBarAlwaysOff);
+				if (scroll_area->horizontalScrollBarPolicy() == Qt::ScrollBarAlwaysOff)
+					scroll_area->setMinimumWidth(preview->sizeHint().width() +
+					                             (scroll_area->verticalScrollBarPolicy() == Qt::ScrollBarAlwaysOff
+					                              ? 0
+					                              : scroll_area->verticalScrollBar()->width()));
+				if (scroll_area->verticalScrollBarPolicy() == Qt::ScrollBarAlwaysOff)
+					scroll_area->setMinimumHeight(preview->sizeHint().height() +
+					                              (scroll_area->horizontalScrollBarPolicy() == Qt::ScrollBarAlwaysOff
+					                               ? 0
+					                               : scroll_area->verticalScrollBar()->height()));
+				scroll_area->setWidget(preview);
+				return scroll_area;
 			}
-			scroll_area->setHorizontalScrollBarPolicy(preview->info().tilemapWidth() > 16
-			                                          ? Qt::ScrollBarAlwaysOn
-			                                          : Qt::ScrollBarAlwaysOff);
-			scroll_area->setVerticalScrollBarPolicy(preview->info().tilemapHeight() > 16
-			                                        ? Qt::ScrollBarAlwaysOn
-			                                        : Qt::ScrollBarAlwaysOff);
-			if (scroll_area->horizontalScrollBarPolicy() == Qt::ScrollBarAlwaysOff)
-				scroll_area->setMinimumWidth(preview->sizeHint().width() +
-				                             (scroll_area->verticalScrollBarPolicy() == Qt::ScrollBarAlwaysOff
-				                              ? 0
-				                              : scroll_area->verticalScrollBar()->width()));
-			if (scroll_area->verticalScrollBarPolicy() == Qt::ScrollBarAlwaysOff)
-				scroll_area->setMinimumHeight(preview->sizeHint().height() +
-				                              (scroll_area->horizontalScrollBarPolicy() == Qt::ScrollBarAlwaysOff
-				                               ? 0
-				                               : scroll_area->verticalScrollBar()->height()));
-			scroll_area->setWidget(preview);
-			tabs->addTab(scroll_area, name);
-		}
-		catch (std::exception &e) {
-			qCritical().noquote() << tr("Cannot create preview %1 from %2: %3")
-			               .arg(name)
-			               .arg(file.fileName())
-			               .arg(e.what());
-		}
-		file.close();
+			catch (std::exception &e) {
+				qCritical().noquote() << tr("Cannot create preview %1 from %2: %3")
+				               .arg(p.name)
+				               .arg(p.movie)
+				               .arg(e.what());
+				return nullptr;
+			}
+		};
+		tabs->addTab(new DeferredWidget(factory), p.name);
 	}
-	settings.endArray();
 	layout->addWidget(tabs);
 
 	central_widget->setLayout(layout);
@@ -216,6 +170,10 @@ MainWindow::MainWindow(const QString &config_path, QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+	LogWindow::instance()->setTilesets({});
+	// icon jobs may still be reading tilesets
+	QThreadPool::globalInstance()->clear();
+	QThreadPool::globalInstance()->waitForDone();
 }
 
 void MainWindow::on_save_action_triggered()
@@ -259,11 +217,11 @@ void MainWindow::on_save_action_triggered()
 		}
 		Q_UNREACHABLE();
 	};
-	std::vector<std::pair<QString, const QPixmap *>> files; // tileset, layer, filename
-	for (const auto &tileset: _tilesets) {
+	std::vector<std::pair<QString, const QImage *>> files; // tileset, layer, filename
+	for (const auto &tileset: _pack->tilesets()) {
 		auto outputs = tileset->outputs();
 		for (unsigned int i = 0; i < outputs.size(); ++i)
-			files.emplace_back(outputs[i], &tileset->pixmap(i));
+			files.emplace_back(outputs[i], &tileset->image(i));
 	}
 	std::vector<QString> status(files.size());
 	for (unsigned int i = 0; i < files.size(); ++i) {
@@ -279,7 +237,12 @@ void MainWindow::on_save_action_triggered()
 			all_saved = false;
 			continue;
 		}
-		if (!files[i].second->save(output)) {
+		bool saved;
+		{
+			PerfCounters::ScopedTimer timer(PerfCounters::Stage::Save);
+			saved = files[i].second->save(output);
+		}
+		if (!saved) {
 			status[i] = tr("failed to save tileset");
 			all_saved = false;
 		}
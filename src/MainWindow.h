@@ -21,10 +21,8 @@
 
 #include <memory>
 
-#include "Palette.h"
-
 class AboutDialog;
-class Tileset;
+class Pack;
 
 class MainWindow : public QMainWindow, private Ui::MainWindow
 {
@@ -41,10 +39,7 @@ protected:
 	void closeEvent(QCloseEvent *) override;
 
 private:
-	std::vector<std::unique_ptr<Tileset>> _tilesets;
-	std::vector<std::pair<QString, Palette>> _palettes;
-	std::vector<std::pair<QString, QColor>> _backgrounds;
-	std::vector<std::pair<QString, QColor>> _outlines;
+	std::unique_ptr<Pack> _pack;
 	std::unique_ptr<AboutDialog> _about_dialog;
 
 };
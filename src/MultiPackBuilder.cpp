@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "MultiPackBuilder.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QtConcurrent>
+
+#include <cstdio>
+#include <set>
+
+#include "Pack.h"
+#include "Tileset.h"
+
+#include <QtDebug>
+
+struct MultiPackBuilder::pack_t {
+	QString path;
+	std::unique_ptr<Pack> pack;
+	std::vector<std::unique_ptr<tileset_job_t>> tilesets;
+	unsigned int decoded_files = 0, shared_files = 0;
+	qint64 parse_ms = 0;
+	// times are summed over jobs, finished_ms is the time since the build start
+	std::atomic<qint64> decode_ms{0}, assemble_ms{0}, encode_ms{0}, finished_ms{0};
+};
+
+struct MultiPackBuilder::tileset_job_t {
+	pack_t *pack;
+	unsigned int index;
+	// files for each source used by the tileset, in sourceFileNames order
+	std::vector<std::pair<const Tileset::source_t *, std::vector<file_t *>>> sources;
+	std::atomic<unsigned int> pending_files{0};
+	std::vector<QString> outputs; // absolute paths
+};
+
+struct MultiPackBuilder::file_t {
+	QString path;
+	pack_t *owner; // first pack using the file, the decode time is counted there
+	QImage image; // released once every user is assembled
+	std::vector<tileset_job_t *> users;
+	std::atomic<unsigned int> pending_users{0};
+};
+
+// Pack parsing only logs errors, they are counted while parsing
+static QtMessageHandler previous_handler = nullptr;
+static std::atomic<unsigned int> parse_error_count(0);
+
+static void countParseErrors(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+	if (type == QtCriticalMsg || type == QtFatalMsg)
+		++parse_error_count;
+	if (previous_handler)
+		previous_handler(type, context, message);
+	else
+		std::fprintf(stderr, "%s\n", qPrintable(qFormatLogMessage(type, context, message)));
+}
+
+MultiPackBuilder::MultiPackBuilder(int job_count)
+        : _ok(true)
+{
+	_pool.setMaxThreadCount(job_count);
+}
+
+MultiPackBuilder::~MultiPackBuilder()
+{
+	_pool.waitForDone();
+}
+
+bool MultiPackBuilder::addPacks(const QStringList &paths)
+{
+	bool ok = true;
+	QStringList config_paths;
+	for (const auto &path: paths) {
+		QFileInfo info(path);
+		if (info.isDir()) {
+			QDir dir(path);
+			for (const auto &name: dir.entryList({ "*.ini" }, QDir::Files, QDir::Name))
+				config_paths.append(dir.absoluteFilePath(name));
+		}
+		else if (info.isFile())
+			config_paths.append(info.absoluteFilePath());
+		else {
+			qCritical().noquote() << tr("No pack configuration at %1").arg(path);
+			ok = false;
+		}
+	}
+
+	// Paths are resolved while the current directory is the pack directory
+	auto current_dir = QDir::currentPath();
+	for (const auto &config_path: config_paths) {
+		QElapsedTimer timer;
+		timer.start();
+		QDir::setCurrent(QFileInfo(config_path).absolutePath());
+		auto pack = std::make_unique<pack_t>();
+		pack->path = config_path;
+		parse_error_count = 0;
+		previous_handler = qInstallMessageHandler(&countParseErrors);
+		pack->pack = std::make_unique<Pack>(config_path, Pack::Source::TextParseOnly);
+		qInstallMessageHandler(previous_handler);
+		if (parse_error_count > 0) {
+			qCritical().noquote() << tr("%n error(s) while parsing %1", nullptr, static_cast<int>(parse_error_count.load()))
+			                         .arg(config_path);
+			ok = false;
+		}
+		std::set<file_t *> pack_files;
+		const auto &tilesets = pack->pack->tilesets();
+		for (unsigned int i = 0; i < tilesets.size(); ++i) {
+			const auto &tileset = *tilesets[i];
+			auto job = std::make_unique<tileset_job_t>();
+			job->pack = pack.get();
+			job->index = i;
+			for (const auto &output: tileset.outputs())
+				job->outputs.push_back(QFileInfo(output).absoluteFilePath());
+			std::set<const Tileset::source_t *> sources;
+			for (const auto &layer: tileset.layers())
+				for (const auto &alternative: layer.alternatives)
+					for (const auto &p: alternative.sources)
+						sources.insert(p.first);
+			std::set<file_t *> job_files;
+			for (auto source: sources) {
+				std::vector<file_t *> source_files;
+				for (const auto &name: tileset.sourceFileNames(source->name)) {
+					auto &file = _files[QFileInfo(name).absoluteFilePath()];
+					if (!file) {
+						file = std::make_unique<file_t>();
+						file->path = QFileInfo(name).absoluteFilePath();
+						file->owner = pack.get();
+					}
+					source_files.push_back(file.get());
+					if (job_files.insert(file.get()).second) {
+						file->users.push_back(job.get());
+						++file->pending_users;
+					}
+				}
+				job->sources.emplace_back(source, std::move(source_files));
+			}
+			job->pending_files = static_cast<unsigned int>(job_files.size());
+			pack_files.insert(job_files.begin(), job_files.end());
+			pack->tilesets.push_back(std::move(job));
+		}
+		for (auto file: pack_files) {
+			if (file->owner == pack.get())
+				++pack->decoded_files;
+			else
+				++pack->shared_files;
+		}
+		pack->parse_ms = timer.elapsed();
+		_packs.push_back(std::move(pack));
+	}
+	QDir::setCurrent(current_dir);
+	if (config_paths.isEmpty()) {
+		qCritical().noquote() << tr("No pack configuration to build");
+		ok = false;
+	}
+	return ok;
+}
+
+bool MultiPackBuilder::build()
+{
+	_timer.start();
+	for (auto &pack: _packs)
+		for (auto &job: pack->tilesets)
+			if (job->pending_files == 0) {
+				auto job_ptr = job.get();
+				QtConcurrent::run(&_pool, [this, job_ptr] () { assemble(*job_ptr); });
+			}
+	for (auto &p: _files) {
+		auto file = p.second.get();
+		QtConcurrent::run(&_pool, [this, file] () { decode(*file); });
+	}
+	// jobs queue their dependent jobs before finishing
+	_pool.waitForDone();
+	return _ok;
+}
+
+void MultiPackBuilder::decode(file_t &file)
+{
+	QElapsedTimer timer;
+	timer.start();
+	qDebug().noquote() << tr("Loading %1").arg(file.path);
+	if (!file.image.load(file.path)) {
+		qCritical().noquote() << tr("Failed to load source image from %1.").arg(file.path);
+		_ok = false;
+	}
+	file.owner->decode_ms += timer.elapsed();
+	finishJob(*file.owner);
+	for (auto job: file.users)
+		if (--job->pending_files == 0)
+			QtConcurrent::run(&_pool, [this, job] () { assemble(*job); });
+}
+
+void MultiPackBuilder::assemble(tileset_job_t &job)
+{
+	QElapsedTimer timer;
+	timer.start();
+	auto &tileset = *job.pack->pack->tilesets()[job.index];
+	std::set<file_t *> files;
+	for (const auto &p: job.sources) {
+		std::vector<QImage> sheets;
+		for (auto file: p.second) {
+			sheets.push_back(file->image);
+			files.insert(file);
+		}
+		tileset.loadSource(*p.first, sheets);
+	}
+	for (auto file: files)
+		if (--file->pending_users == 0)
+			file->image = QImage();
+	tileset.assemble();
+	job.pack->assemble_ms += timer.elapsed();
+	finishJob(*job.pack);
+	for (unsigned int i = 0; i < job.outputs.size(); ++i)
+		QtConcurrent::run(&_pool, [this, &job, i] () { encode(job, i); });
+}
+
+void MultiPackBuilder::encode(tileset_job_t &job, unsigned int image)
+{
+	QElapsedTimer timer;
+	timer.start();
+	const auto &tileset = *job.pack->pack->tilesets()[job.index];
+	const auto &filename = job.outputs[image];
+	if (!QDir().mkpath(QFileInfo(filename).path()) || !tileset.image(image).save(filename)) {
+		qCritical().noquote() << tr("Failed to save %1").arg(filename);
+		_ok = false;
+	}
+	else
+		qInfo().noquote() << tr("Saved %1").arg(filename);
+	job.pack->encode_ms += timer.elapsed();
+	finishJob(*job.pack);
+}
+
+void MultiPackBuilder::finishJob(pack_t &pack)
+{
+	auto elapsed = _timer.elapsed();
+	auto finished = pack.finished_ms.load();
+	while (finished < elapsed && !pack.finished_ms.compare_exchange_weak(finished, elapsed))
+		;
+}
+
+QByteArray MultiPackBuilder::summary() const
+{
+	// the pack name is substituted last, so that it may contain '%'
+	const QString row("%8 %1 %2 %3 %4 %5 %6 %7\n");
+	auto text = row.arg(tr("Parse"), 8)
+	               .arg(tr("Decode"), 8)
+	               .arg(tr("Assembly"), 8)
+	               .arg(tr("Encode"), 8)
+	               .arg(tr("Finished"), 8)
+	               .arg(tr("Files"), 6)
+	               .arg(tr("Shared"), 6)
+	               .arg(tr("Pack"), -32);
+	for (const auto &pack: _packs)
+		text += row.arg(pack->parse_ms, 8)
+		           .arg(pack->decode_ms.load(), 8)
+		           .arg(pack->assemble_ms.load(), 8)
+		           .arg(pack->encode_ms.load(), 8)
+		           .arg(pack->finished_ms.load(), 8)
+		           .arg(pack->decoded_files, 6)
+		           .arg(pack->shared_files, 6)
+		           .arg(QDir::current().relativeFilePath(pack->path), -32);
+	text += tr("Times are in milliseconds, summed over the jobs of each pack. "
+	           "Finished is the time since the build start. Shared files were "
+	           "decoded for a previous pack.\n");
+	return text.toLocal8Bit();
+}
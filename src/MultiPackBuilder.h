@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef MULTI_PACK_BUILDER_H
+#define MULTI_PACK_BUILDER_H
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThreadPool>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Build the outputs of several packs in a single job graph.
+//
+// Packs are parsed first, then every source file they use is decoded once,
+// even when it is shared by several packs. A tileset is assembled as soon
+// as its files are decoded, and each of its outputs is encoded as soon as
+// it is assembled. All jobs run on the same thread pool.
+class MultiPackBuilder
+{
+	Q_DECLARE_TR_FUNCTIONS(MultiPackBuilder)
+public:
+	explicit MultiPackBuilder(int job_count);
+	~MultiPackBuilder();
+
+	// Parse pack configurations, directories are searched for *.ini files.
+	// Relative paths in a configuration are relative to its directory.
+	// Returns false if a pack is missing or has parse errors.
+	bool addPacks(const QStringList &paths);
+	// Decode, assemble and save the outputs of every pack, returns false if
+	// a source could not be loaded or an output could not be saved.
+	bool build();
+	// Timing of each pack as a text table
+	QByteArray summary() const;
+
+private:
+	struct pack_t;
+	struct tileset_job_t;
+	struct file_t;
+
+	void decode(file_t &file);
+	void assemble(tileset_job_t &job);
+	void encode(tileset_job_t &job, unsigned int image);
+	// Record the end of a job of pack
+	void finishJob(pack_t &pack);
+
+	QThreadPool _pool;
+	QElapsedTimer _timer;
+	std::vector<std::unique_ptr<pack_t>> _packs;
+	std::map<QString, std::unique_ptr<file_t>> _files; // by absolute path
+	std::atomic<bool> _ok;
+};
+
+#endif // MULTI_PACK_BUILDER_H
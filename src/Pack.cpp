@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "Pack.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QPalette>
+#include <QSettings>
+
+#include <algorithm>
+#include <tuple>
+
+#include "PackBundle.h"
+#include "Tileset.h"
+
+#include <QtDebug>
+
+template<typename T, typename U>
+static std::vector<T *> ptr_vec(const std::vector<std::unique_ptr<U>> &vec)
+{
+	std::vector<T *> out;
+	out.reserve(vec.size());
+	for (const auto &ptr: vec)
+		out.push_back(ptr.get());
+	return out;
+}
+
+Pack::Pack(const QString &config_path, Source source)
+        : _from_bundle(false)
+{
+	if (source == Source::BundleOrText && loadBundle(bundlePath(config_path)))
+		return;
+	loadText(config_path, source != Source::TextParseOnly);
+}
+
+Pack::~Pack()
+{
+}
+
+QString Pack::bundlePath(const QString &config_path)
+{
+	return config_path + ".bundle";
+}
+
+void Pack::loadText(const QString &config_path, bool assemble)
+{
+	QSettings settings(config_path, QSettings::IniFormat);
+	addDependency(config_path);
+	// Keep source tiles compressed for packs with many alternatives
+	if (settings.value("compress_tiles", false).toBool())
+		_tile_pool.setCompressed(true);
+
+	// Create tilesets
+	auto tileset_count = settings.beginReadArray("tilesets");
+	for (int i = 0; i < tileset_count; ++i) {
+		settings.setArrayIndex(i);
+		_tilesets.emplace_back(std::make_unique<Tileset>(settings, _tile_pool, assemble));
+		for (const auto &filename: _tilesets.back()->dependencies())
+			addDependency(filename);
+	}
+	settings.endArray();
+
+	// Load palettes and colors
+	settings.beginGroup("colors");
+	int palette_count = settings.beginReadArray("palette");
+	for (int i = 0; i < palette_count; ++i) {
+		settings.setArrayIndex(i);
+		auto name = settings.value("name", tr("Unnamed palette")).toString();
+		QFile file(settings.value("file").toString());
+		addDependency(file.fileName());
+		if (!file.open(QIODevice::ReadOnly)) {
+			qCritical().noquote() << tr("Cannot open palette: %1").arg(file.fileName());
+			continue;
+		}
+		_palettes.emplace_back(name, &file);
+	}
+	settings.endArray();
+	if (_palettes.empty())
+		_palettes.emplace_back(tr("Default palette"), Palette());
+	int bg_count = settings.beginReadArray("background");
+	for (int i = 0; i < bg_count; ++i) {
+		settings.setArrayIndex(i);
+		auto name = settings.value("name", tr("Unnamed background color")).toString();
+		auto color = settings.value("color").toString();
+		_backgrounds.emplace_back(name, color);
+	}
+	settings.endArray();
+	if (_backgrounds.empty())
+		_backgrounds.emplace_back(tr("Default background"),
+		                          QPalette().color(QPalette::Base));
+	int outline_count = settings.beginReadArray("outline");
+	for (int i = 0; i < outline_count; ++i) {
+		settings.setArrayIndex(i);
+		auto name = settings.value("name", tr("Unnamed outline color")).toString();
+		auto color = settings.value("color").toString();
+		_outlines.emplace_back(name, color);
+	}
+	settings.endArray();
+	if (_outlines.empty())
+		_outlines.emplace_back(tr("Red"), Qt::red);
+	settings.endGroup();
+
+	// Parse previews
+	int preview_count = settings.beginReadArray("previews");
+	for (int i = 0; i < preview_count; ++i) {
+		settings.setArrayIndex(i);
+		auto name = settings.value("name", tr("Unnamed Preview")).toString();
+		if (settings.contains("movie")) {
+			_previews.push_back({ name, settings.value("movie").toString(), Preview() });
+			continue;
+		}
+		QFile file(settings.value("file").toString());
+		addDependency(file.fileName());
+		if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+			qCritical().noquote() << tr("Failed to open preview file: %1").arg(file.fileName());
+			continue;
+		}
+		try {
+			_previews.push_back({ name, QString(), Preview(&file, constTilesetPointers()) });
+		}
+		catch (std::exception &e) {
+			qCritical().noquote() << tr("Cannot create preview %1 from %2: %3")
+			               .arg(name)
+			               .arg(file.fileName())
+			               .arg(e.what());
+		}
+	}
+	settings.endArray();
+}
+
+bool Pack::loadBundle(const QString &bundle_path)
+{
+	if (!QFile::exists(bundle_path))
+		return false;
+	try {
+		_bundle = std::make_unique<PackBundle::Reader>(bundle_path);
+		auto &reader = *_bundle;
+		auto &stream = reader.stream();
+
+		quint32 dependency_count = 0;
+		stream >> dependency_count;
+		for (quint32 i = 0; i < dependency_count && stream.status() == QDataStream::Ok; ++i) {
+			QString filename;
+			qint64 size, modified;
+			bool exists;
+			stream >> filename >> size >> modified >> exists;
+			QFileInfo info(filename);
+			if (info.exists() != exists ||
+			    (exists && (info.size() != size ||
+			                info.lastModified().toMSecsSinceEpoch() != modified))) {
+				qDebug().noquote() << tr("Bundle %1 is out of date: %2 changed.")
+				                      .arg(bundle_path)
+				                      .arg(filename);
+				_dependencies.clear();
+				_bundle.reset();
+				return false;
+			}
+			_dependencies.push_back(filename);
+		}
+
+		quint32 palette_count = 0;
+		stream >> palette_count;
+		for (quint32 i = 0; i < palette_count && stream.status() == QDataStream::Ok; ++i) {
+			QString name;
+			Palette palette;
+			stream >> name;
+			for (auto &color: palette.colors)
+				stream >> color;
+			_palettes.emplace_back(name, palette);
+		}
+		for (auto colors: { &_backgrounds, &_outlines }) {
+			quint32 color_count = 0;
+			stream >> color_count;
+			for (quint32 i = 0; i < color_count && stream.status() == QDataStream::Ok; ++i) {
+				QString name;
+				QColor color;
+				stream >> name >> color;
+				colors->emplace_back(name, color);
+			}
+		}
+
+		_tile_pool.load(reader);
+		quint32 tileset_count = 0;
+		stream >> tileset_count;
+		for (quint32 i = 0; i < tileset_count && stream.status() == QDataStream::Ok; ++i)
+			_tilesets.emplace_back(std::make_unique<Tileset>(reader, _tile_pool));
+
+		quint32 preview_count = 0;
+		stream >> preview_count;
+		for (quint32 i = 0; i < preview_count && stream.status() == QDataStream::Ok; ++i) {
+			_previews.emplace_back();
+			auto &preview = _previews.back();
+			stream >> preview.name >> preview.movie >> preview.preview;
+		}
+
+		if (stream.status() != QDataStream::Ok ||
+		    _palettes.empty() || _backgrounds.empty() || _outlines.empty())
+			throw std::runtime_error(tr("Corrupted bundle data").toLocal8Bit().data());
+
+		// Indices from the bundle are used without further checks
+		const auto tileset_count = _tilesets.size();
+		const auto color_count = std::tuple_size<decltype(Palette::colors)>::value;
+		for (const auto &preview: _previews) {
+			for (const auto &layer: preview.preview.layers) {
+				if (std::any_of(layer.source_tilesets.begin(), layer.source_tilesets.end(),
+				                [tileset_count] (unsigned int index) { return index >= tileset_count; }))
+					throw std::runtime_error(tr("Invalid tileset index in preview %1").arg(preview.name).toLocal8Bit().data());
+				for (const auto colors: { &layer.fg_colors, &layer.bg_colors })
+					if (std::any_of(colors->begin(), colors->end(),
+					                [color_count] (uint8_t color) { return color >= color_count; }))
+						throw std::runtime_error(tr("Invalid color index in preview %1").arg(preview.name).toLocal8Bit().data());
+			}
+		}
+	}
+	catch (std::exception &e) {
+		qWarning().noquote() << tr("Cannot use bundle %1: %2").arg(bundle_path).arg(e.what());
+		_tilesets.clear();
+		_tile_pool.clear();
+		_palettes.clear();
+		_backgrounds.clear();
+		_outlines.clear();
+		_previews.clear();
+		_dependencies.clear();
+		_bundle.reset();
+		return false;
+	}
+	_from_bundle = true;
+	return true;
+}
+
+bool Pack::compile(const QString &bundle_path) const
+{
+	PackBundle::Writer writer;
+	auto &stream = writer.stream();
+
+	stream << static_cast<quint32>(_dependencies.size());
+	for (const auto &filename: _dependencies) {
+		QFileInfo info(filename);
+		stream << filename
+		       << static_cast<qint64>(info.size())
+		       << static_cast<qint64>(info.lastModified().toMSecsSinceEpoch())
+		       << info.exists();
+	}
+
+	stream << static_cast<quint32>(_palettes.size());
+	for (const auto &p: _palettes) {
+		stream << p.first;
+		for (const auto &color: p.second.colors)
+			stream << color;
+	}
+	for (auto colors: { &_backgrounds, &_outlines }) {
+		stream << static_cast<quint32>(colors->size());
+		for (const auto &p: *colors)
+			stream << p.first << p.second;
+	}
+
+	for (const auto &tileset: _tilesets)
+		tileset->loadSources();
+	_tile_pool.logStatistics();
+	_tile_pool.save(writer);
+	stream << static_cast<quint32>(_tilesets.size());
+	for (const auto &tileset: _tilesets)
+		tileset->save(writer);
+
+	stream << static_cast<quint32>(_previews.size());
+	for (const auto &p: _previews)
+		stream << p.name << p.movie << p.preview;
+
+	return writer.save(bundle_path);
+}
+
+bool Pack::loadedFromBundle() const
+{
+	return _from_bundle;
+}
+
+void Pack::addDependency(const QString &filename)
+{
+	if (std::find(_dependencies.begin(), _dependencies.end(), filename) == _dependencies.end())
+		_dependencies.push_back(filename);
+}
+
+const std::vector<std::unique_ptr<Tileset>> &Pack::tilesets() const
+{
+	return _tilesets;
+}
+
+const TilePool &Pack::tilePool() const
+{
+	return _tile_pool;
+}
+
+std::vector<Tileset *> Pack::tilesetPointers() const
+{
+	return ptr_vec<Tileset>(_tilesets);
+}
+
+std::vector<const Tileset *> Pack::constTilesetPointers() const
+{
+	return ptr_vec<const Tileset>(_tilesets);
+}
+
+const std::vector<std::pair<QString, Palette>> &Pack::palettes() const
+{
+	return _palettes;
+}
+
+const std::vector<std::pair<QString, QColor>> &Pack::backgrounds() const
+{
+	return _backgrounds;
+}
+
+const std::vector<std::pair<QString, QColor>> &Pack::outlines() const
+{
+	return _outlines;
+}
+
+const std::vector<Pack::preview_t> &Pack::previews() const
+{
+	return _previews;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PACK_H
+#define PACK_H
+
+#include <QCoreApplication>
+
+#include <memory>
+#include <vector>
+
+#include "PackBundle.h"
+#include "Palette.h"
+#include "Preview.h"
+#include "TilePool.h"
+
+class Tileset;
+
+// Tilesets, colors and previews of a pack configuration.
+//
+// They are loaded from the compiled bundle next to the configuration file
+// when it is up to date, or parsed from the text sources otherwise.
+class Pack
+{
+	Q_DECLARE_TR_FUNCTIONS(Pack)
+public:
+	enum class Source
+	{
+		BundleOrText,
+		Text,
+		TextParseOnly, // no image is decoded and tilesets are not assembled
+	};
+	explicit Pack(const QString &config_path, Source source = Source::BundleOrText);
+	~Pack();
+
+	static QString bundlePath(const QString &config_path);
+	bool compile(const QString &bundle_path) const;
+	bool loadedFromBundle() const;
+
+	const std::vector<std::unique_ptr<Tileset>> &tilesets() const;
+	const TilePool &tilePool() const;
+	std::vector<Tileset *> tilesetPointers() const;
+	std::vector<const Tileset *> constTilesetPointers() const;
+
+	const std::vector<std::pair<QString, Palette>> &palettes() const;
+	const std::vector<std::pair<QString, QColor>> &backgrounds() const;
+	const std::vector<std::pair<QString, QColor>> &outlines() const;
+
+	struct preview_t {
+		QString name;
+		QString movie; // movie file name, the preview cells are unused when set
+		Preview preview;
+	};
+	const std::vector<preview_t> &previews() const;
+
+private:
+	void loadText(const QString &config_path, bool assemble);
+	bool loadBundle(const QString &bundle_path);
+	void addDependency(const QString &filename);
+
+	// images from the bundle point into its mapping, keep it before tiles
+	std::unique_ptr<PackBundle::Reader> _bundle;
+	TilePool _tile_pool;
+	std::vector<std::unique_ptr<Tileset>> _tilesets;
+	std::vector<std::pair<QString, Palette>> _palettes;
+	std::vector<std::pair<QString, QColor>> _backgrounds;
+	std::vector<std::pair<QString, QColor>> _outlines;
+	std::vector<preview_t> _previews;
+	std::vector<QString> _dependencies;
+	bool _from_bundle;
+};
+
+#endif // PACK_H
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "PackBundle.h"
+
+#include <QSaveFile>
+
+constexpr quint32 PackBundle::Magic;
+constexpr quint32 PackBundle::Version;
+constexpr int PackBundle::HeaderSize;
+constexpr int PackBundle::BlobAlignment;
+
+static constexpr quint32 ByteOrderMark = 0x01020304;
+static constexpr auto StreamVersion = QDataStream::Qt_5_6;
+
+static qint64 blobOffset(qint64 metadata_size)
+{
+	auto end = PackBundle::HeaderSize + metadata_size;
+	return (end + PackBundle::BlobAlignment - 1) / PackBundle::BlobAlignment * PackBundle::BlobAlignment;
+}
+
+PackBundle::Writer::Writer()
+        : _stream(&_metadata, QIODevice::WriteOnly)
+{
+	_stream.setVersion(StreamVersion);
+}
+
+QDataStream &PackBundle::Writer::stream()
+{
+	return _stream;
+}
+
+void PackBundle::Writer::writeImage(const QImage &image)
+{
+	if (image.isNull()) {
+		_stream << QSize() << quint64(0);
+		return;
+	}
+	auto converted = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	_stream << converted.size() << static_cast<quint64>(_pixels.size());
+	for (int y = 0; y < converted.height(); ++y)
+		_pixels.append(reinterpret_cast<const char *>(converted.constScanLine(y)),
+		               converted.width() * 4);
+}
+
+bool PackBundle::Writer::save(const QString &filename)
+{
+	QSaveFile file(filename);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+	QDataStream header(&file);
+	header << Magic << Version;
+	header.writeRawData(reinterpret_cast<const char *>(&ByteOrderMark), sizeof(ByteOrderMark));
+	header << static_cast<quint64>(_metadata.size());
+	file.write(_metadata);
+	file.write(QByteArray(static_cast<int>(blobOffset(_metadata.size()) - file.pos()), '\0'));
+	file.write(_pixels);
+	return file.commit();
+}
+
+PackBundle::Reader::Reader(const QString &filename)
+        : _file(filename)
+        , _pixels(nullptr)
+        , _pixels_size(0)
+{
+	if (!_file.open(QIODevice::ReadOnly))
+		throw std::runtime_error(tr("Failed to open \"%1\".").arg(filename).toLocal8Bit().data());
+	auto file_size = _file.size();
+	if (file_size < HeaderSize)
+		throw std::runtime_error(tr("Truncated bundle header").toLocal8Bit().data());
+	auto data = _file.map(0, file_size);
+	if (!data)
+		throw std::runtime_error(tr("Failed to map \"%1\".").arg(filename).toLocal8Bit().data());
+
+	QDataStream header(QByteArray::fromRawData(reinterpret_cast<const char *>(data), HeaderSize));
+	quint32 magic, version, byte_order;
+	quint64 metadata_size;
+	header >> magic >> version;
+	header.readRawData(reinterpret_cast<char *>(&byte_order), sizeof(byte_order));
+	header >> metadata_size;
+	if (magic != Magic || byte_order != ByteOrderMark)
+		throw std::runtime_error(tr("Not a tileset bundle").toLocal8Bit().data());
+	if (version != Version)
+		throw std::runtime_error(tr("Unsupported bundle version: %1").arg(version).toLocal8Bit().data());
+	if (metadata_size > static_cast<quint64>(file_size - HeaderSize))
+		throw std::runtime_error(tr("Truncated bundle metadata").toLocal8Bit().data());
+	auto offset = blobOffset(static_cast<qint64>(metadata_size));
+	_pixels = data + offset;
+	_pixels_size = std::max<qint64>(0, file_size - offset);
+
+	_metadata.setData(QByteArray::fromRawData(reinterpret_cast<const char *>(data) + HeaderSize,
+	                                          static_cast<int>(metadata_size)));
+	_metadata.open(QIODevice::ReadOnly);
+	_stream.setDevice(&_metadata);
+	_stream.setVersion(StreamVersion);
+}
+
+QDataStream &PackBundle::Reader::stream()
+{
+	return _stream;
+}
+
+QImage PackBundle::Reader::readImage()
+{
+	QSize size;
+	quint64 offset;
+	_stream >> size >> offset;
+	if (_stream.status() != QDataStream::Ok || size.isEmpty())
+		return QImage();
+	auto byte_size = static_cast<quint64>(size.width()) * static_cast<quint64>(size.height()) * 4;
+	if (offset + byte_size > static_cast<quint64>(_pixels_size)) {
+		_stream.setStatus(QDataStream::ReadCorruptData);
+		return QImage();
+	}
+	return QImage(_pixels + offset, size.width(), size.height(), size.width() * 4,
+	              QImage::Format_ARGB32_Premultiplied);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PACK_BUNDLE_H
+#define PACK_BUNDLE_H
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QFile>
+#include <QImage>
+
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+// Binary pack bundle: a versioned header, metadata written with QDataStream
+// and a blob of pre-decoded premultiplied ARGB32 pixels. The reader maps the
+// file in memory and images read from it point directly into the mapping.
+class PackBundle
+{
+	Q_DECLARE_TR_FUNCTIONS(PackBundle)
+public:
+	static constexpr quint32 Magic = 0x54534142; // "TSAB"
+	static constexpr quint32 Version = 5;
+	static constexpr int HeaderSize = 20;
+	static constexpr int BlobAlignment = 16;
+
+	class Writer
+	{
+	public:
+		Writer();
+
+		QDataStream &stream();
+		void writeImage(const QImage &image);
+		bool save(const QString &filename);
+
+	private:
+		QByteArray _metadata;
+		QDataStream _stream;
+		QByteArray _pixels;
+	};
+
+	class Reader
+	{
+	public:
+		// throws std::runtime_error if the file is not a valid bundle
+		explicit Reader(const QString &filename);
+
+		QDataStream &stream();
+		// returned images are only valid while the reader exists
+		QImage readImage();
+
+	private:
+		QFile _file;
+		const uchar *_pixels;
+		qint64 _pixels_size;
+		QBuffer _metadata;
+		QDataStream _stream;
+	};
+
+	template<typename T>
+	static void writeVector(QDataStream &stream, const std::vector<T> &vec)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "vector elements are written as raw data");
+		stream << static_cast<quint32>(vec.size());
+		stream.writeRawData(reinterpret_cast<const char *>(vec.data()),
+		                    static_cast<int>(vec.size() * sizeof(T)));
+	}
+
+	template<typename T>
+	static void readVector(QDataStream &stream, std::vector<T> &vec)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "vector elements are read as raw data");
+		quint32 size;
+		stream >> size;
+		if (stream.status() != QDataStream::Ok || size > std::numeric_limits<int>::max() / sizeof(T) ||
+		    (stream.device() && static_cast<qint64>(size * sizeof(T)) > stream.device()->bytesAvailable())) {
+			stream.setStatus(QDataStream::ReadCorruptData);
+			return;
+		}
+		vec.resize(size);
+		int byte_size = static_cast<int>(size * sizeof(T));
+		if (stream.readRawData(reinterpret_cast<char *>(vec.data()), byte_size) != byte_size)
+			stream.setStatus(QDataStream::ReadPastEnd);
+	}
+};
+
+#endif // PACK_BUNDLE_H
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "PackChecker.h"
+
+#include <QFileInfo>
+#include <QImageReader>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include "Pack.h"
+#include "Tileset.h"
+
+static PackChecker *current_checker = nullptr;
+
+PackChecker::PackChecker(const QString &config_path)
+        : _config_path(config_path)
+{
+	// Messages logged while parsing are collected as problems
+	current_checker = this;
+	auto previous_handler = qInstallMessageHandler(&PackChecker::handleMessage);
+	{
+		Pack pack(config_path, Pack::Source::TextParseOnly);
+		qInstallMessageHandler(previous_handler);
+		current_checker = nullptr;
+		probeSources(pack);
+		for (const auto &preview: pack.previews())
+			if (!preview.movie.isEmpty() && !QFileInfo::exists(preview.movie))
+				addProblem(Severity::Error, preview.movie, 0,
+				           tr("Movie of preview %1 does not exist").arg(preview.name));
+	}
+}
+
+const std::vector<PackChecker::problem_t> &PackChecker::problems() const
+{
+	return _problems;
+}
+
+unsigned int PackChecker::errorCount() const
+{
+	return static_cast<unsigned int>(std::count_if(_problems.begin(), _problems.end(), [] (const problem_t &problem) {
+		return problem.severity == Severity::Error;
+	}));
+}
+
+QByteArray PackChecker::toJson() const
+{
+	QJsonArray problems;
+	for (const auto &problem: _problems) {
+		QJsonObject object;
+		object["severity"] = problem.severity == Severity::Error ? "error" : "warning";
+		if (!problem.file.isEmpty())
+			object["file"] = problem.file;
+		if (problem.line > 0)
+			object["line"] = problem.line;
+		object["message"] = problem.message;
+		problems.append(object);
+	}
+	auto error_count = errorCount();
+	QJsonObject root;
+	root["config"] = _config_path;
+	root["errors"] = static_cast<int>(error_count);
+	root["warnings"] = static_cast<int>(_problems.size() - error_count);
+	root["problems"] = problems;
+	return QJsonDocument(root).toJson();
+}
+
+void PackChecker::handleMessage(QtMsgType type, const QMessageLogContext &, const QString &message)
+{
+	Severity severity;
+	switch (type) {
+	case QtCriticalMsg:
+	case QtFatalMsg:
+		severity = Severity::Error;
+		break;
+	case QtWarningMsg:
+		severity = Severity::Warning;
+		break;
+	default:
+		return;
+	}
+	// Split locations added by FileLineReader::formatError and ParseError
+	static const QRegularExpression location("^(.*):(\\d+): (.*)$");
+	auto match = location.match(message);
+	if (match.hasMatch())
+		current_checker->addProblem(severity, match.captured(1), match.captured(2).toInt(), match.captured(3));
+	else
+		current_checker->addProblem(severity, QString(), 0, message);
+}
+
+void PackChecker::addProblem(Severity severity, const QString &file, int line, const QString &message)
+{
+	_problems.push_back({ severity, file, line, message });
+}
+
+void PackChecker::probeSources(const Pack &pack)
+{
+	struct header_t {
+		QString filename;
+		QSize size;
+		QString error;
+	};
+	std::map<QString, header_t> headers;
+	for (const auto &tileset: pack.tilesets())
+		for (const auto &layer: tileset->layers())
+			for (const auto &alternative: layer.alternatives)
+				for (const auto &p: alternative.sources)
+					for (const auto &filename: tileset->sourceFileNames(p.first->name))
+						headers[filename].filename = filename;
+
+	// QImageReader only reads the header for the size
+	std::vector<header_t *> probes;
+	for (auto &p: headers)
+		probes.push_back(&p.second);
+	QtConcurrent::blockingMap(probes, [] (header_t *header) {
+		if (!QFileInfo::exists(header->filename)) {
+			header->error = tr("file does not exist");
+			return;
+		}
+		QImageReader reader(header->filename);
+		header->size = reader.size();
+		if (!header->size.isValid())
+			header->error = reader.canRead() ? tr("image size is unknown") : reader.errorString();
+	});
+
+	static const char *TWBTSuffixes[] = { "", "-bg", "-top" };
+	for (unsigned int tileset_index = 0; tileset_index < pack.tilesets().size(); ++tileset_index) {
+		const auto &tileset = *pack.tilesets()[tileset_index];
+		const auto &grid = tileset.tilesetInfo().tilemapSize();
+		if (grid.isEmpty()) {
+			addProblem(Severity::Error, QString(), 0,
+			           tr("Tileset %1 has an empty tile grid").arg(tileset_index + 1));
+			continue;
+		}
+		std::set<const Tileset::source_t *> checked;
+		for (const auto &layer: tileset.layers()) {
+			for (const auto &alternative: layer.alternatives) {
+				for (const auto &p: alternative.sources) {
+					if (!checked.insert(p.first).second)
+						continue;
+					auto filenames = tileset.sourceFileNames(p.first->name);
+					QSize main_size;
+					for (unsigned int i = 0; i < filenames.size(); ++i) {
+						const auto &header = headers.at(filenames[i]);
+						if (!header.error.isEmpty()) {
+							if (tileset.mode() == Tileset::Mode::TWBT && i > 0)
+								addProblem(Severity::Error, header.filename, 0,
+								           tr("Missing TWBT %1 sheet for tileset %2: %3")
+								           .arg(TWBTSuffixes[i])
+								           .arg(tileset_index + 1)
+								           .arg(header.error));
+							else
+								addProblem(Severity::Error, header.filename, 0,
+								           tr("Cannot read source image for tileset %1: %2")
+								           .arg(tileset_index + 1)
+								           .arg(header.error));
+							continue;
+						}
+						if (header.size.width() % grid.width() != 0 ||
+						    header.size.height() % grid.height() != 0)
+							addProblem(Severity::Error, header.filename, 0,
+							           tr("Size %1x%2 is not a multiple of the %3x%4 tile grid of tileset %5")
+							           .arg(header.size.width())
+							           .arg(header.size.height())
+							           .arg(grid.width())
+							           .arg(grid.height())
+							           .arg(tileset_index + 1));
+						if (i == 0)
+							main_size = header.size;
+						else if (main_size.isValid() && header.size != main_size)
+							addProblem(Severity::Warning, header.filename, 0,
+							           tr("Size %1x%2 differs from the main TWBT sheet (%3x%4)")
+							           .arg(header.size.width())
+							           .arg(header.size.height())
+							           .arg(main_size.width())
+							           .arg(main_size.height()));
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PACK_CHECKER_H
+#define PACK_CHECKER_H
+
+#include <QCoreApplication>
+
+#include <vector>
+
+class Pack;
+
+// Report problems of a pack without assembling it.
+//
+// Configuration, layer and preview files are parsed, but source images
+// are only probed for their header (in parallel), so missing files, TWBT
+// sheets or sheets not fitting the tile grid are found without decoding
+// any image.
+class PackChecker
+{
+	Q_DECLARE_TR_FUNCTIONS(PackChecker)
+public:
+	enum class Severity
+	{
+		Error,
+		Warning,
+	};
+	struct problem_t {
+		Severity severity;
+		QString file; // empty if the problem is not about a single file
+		int line; // 0 if the problem is not about a single line
+		QString message;
+	};
+
+	explicit PackChecker(const QString &config_path);
+
+	const std::vector<problem_t> &problems() const;
+	unsigned int errorCount() const;
+	// Problems as a JSON document
+	QByteArray toJson() const;
+
+private:
+	static void handleMessage(QtMsgType type, const QMessageLogContext &context, const QString &message);
+	void addProblem(Severity severity, const QString &file, int line, const QString &message);
+	void probeSources(const Pack &pack);
+
+	QString _config_path;
+	std::vector<problem_t> _problems;
+};
+
+#endif // PACK_CHECKER_H
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "PerfCounters.h"
+
+#include <algorithm>
+#include <vector>
+
+constexpr std::size_t PerfCounters::HistorySize;
+
+PerfCounters::PerfCounters()
+{
+	for (auto &stage: _stages) {
+		for (auto &sample: stage.samples)
+			sample.store(0, std::memory_order_relaxed);
+		stage.count.store(0, std::memory_order_relaxed);
+	}
+	for (auto &cache: _caches) {
+		cache.hits.store(0, std::memory_order_relaxed);
+		cache.misses.store(0, std::memory_order_relaxed);
+	}
+	_preview_bytes.store(0, std::memory_order_relaxed);
+}
+
+PerfCounters &PerfCounters::instance()
+{
+	static PerfCounters counters;
+	return counters;
+}
+
+void PerfCounters::addTiming(Stage stage, qint64 nsecs)
+{
+	auto &counters = _stages[static_cast<std::size_t>(stage)];
+	auto index = counters.count.fetch_add(1, std::memory_order_relaxed);
+	counters.samples[index % HistorySize].store(nsecs, std::memory_order_relaxed);
+}
+
+void PerfCounters::addCacheAccess(Cache cache, bool hit)
+{
+	auto &counters = _caches[static_cast<std::size_t>(cache)];
+	(hit ? counters.hits : counters.misses).fetch_add(1, std::memory_order_relaxed);
+}
+
+void PerfCounters::addPreviewBytes(qint64 delta)
+{
+	_preview_bytes.fetch_add(delta, std::memory_order_relaxed);
+}
+
+PerfCounters::timing_t PerfCounters::timing(Stage stage) const
+{
+	const auto &counters = _stages[static_cast<std::size_t>(stage)];
+	timing_t timing = { 0, 0, 0, counters.count.load(std::memory_order_relaxed) };
+	if (timing.count == 0)
+		return timing;
+	std::vector<qint64> samples(std::min<std::size_t>(timing.count, HistorySize));
+	for (std::size_t i = 0; i < samples.size(); ++i)
+		samples[i] = counters.samples[i].load(std::memory_order_relaxed);
+	timing.last = counters.samples[(timing.count - 1) % HistorySize].load(std::memory_order_relaxed);
+	auto percentile = [&samples] (std::size_t p) {
+		auto nth = samples.begin() + static_cast<std::ptrdiff_t>((samples.size() - 1) * p / 100);
+		std::nth_element(samples.begin(), nth, samples.end());
+		return *nth;
+	};
+	timing.p50 = percentile(50);
+	timing.p95 = percentile(95);
+	return timing;
+}
+
+quint64 PerfCounters::cacheHits(Cache cache) const
+{
+	return _caches[static_cast<std::size_t>(cache)].hits.load(std::memory_order_relaxed);
+}
+
+quint64 PerfCounters::cacheMisses(Cache cache) const
+{
+	return _caches[static_cast<std::size_t>(cache)].misses.load(std::memory_order_relaxed);
+}
+
+qint64 PerfCounters::previewBytes() const
+{
+	return _preview_bytes.load(std::memory_order_relaxed);
+}
+
+QString PerfCounters::stageName(Stage stage)
+{
+	switch (stage) {
+	case Stage::Build: return tr("Tileset build");
+	case Stage::PreviewRender: return tr("Preview render");
+	case Stage::Highlight: return tr("Highlight");
+	case Stage::Save: return tr("Save");
+	case Stage::Count: break;
+	}
+	Q_UNREACHABLE();
+}
+
+QString PerfCounters::cacheName(Cache cache)
+{
+	switch (cache) {
+	case Cache::Icon: return tr("Icon cache");
+	case Cache::Composite: return tr("Composite cache");
+	case Cache::TilePool: return tr("Tile pool");
+	case Cache::Assembled: return tr("Assembled selections");
+	case Cache::DecompressedTiles: return tr("Decompressed tiles");
+	case Cache::Count: break;
+	}
+	Q_UNREACHABLE();
+}
+
+PerfCounters::ScopedTimer::ScopedTimer(Stage stage)
+        : _stage(stage)
+{
+	_timer.start();
+}
+
+PerfCounters::ScopedTimer::~ScopedTimer()
+{
+	PerfCounters::instance().addTiming(_stage, _timer.nsecsElapsed());
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+
+#include <array>
+#include <atomic>
+
+// Process-wide timings and cache counters shown in the log window.
+//
+// Counters are updated from hot paths, possibly in worker threads, with
+// relaxed atomics. They are only read for display, so readers may see a
+// slightly inconsistent snapshot.
+class PerfCounters
+{
+	Q_DECLARE_TR_FUNCTIONS(PerfCounters)
+public:
+	enum class Stage
+	{
+		Build, // assembling a tileset selection
+		PreviewRender,
+		Highlight,
+		Save,
+		Count
+	};
+	enum class Cache
+	{
+		Icon,
+		Composite,
+		TilePool,
+		Assembled,
+		DecompressedTiles,
+		Count
+	};
+	// Timings are kept for the last HistorySize samples of each stage
+	static constexpr std::size_t HistorySize = 256;
+
+	static PerfCounters &instance();
+
+	void addTiming(Stage stage, qint64 nsecs);
+	void addCacheAccess(Cache cache, bool hit);
+	void addPreviewBytes(qint64 delta);
+
+	struct timing_t {
+		qint64 last, p50, p95; // nanoseconds
+		unsigned int count; // total sample count
+	};
+	timing_t timing(Stage stage) const;
+	quint64 cacheHits(Cache cache) const;
+	quint64 cacheMisses(Cache cache) const;
+	qint64 previewBytes() const;
+
+	static QString stageName(Stage stage);
+	static QString cacheName(Cache cache);
+
+	// Add the lifetime of the object as a timing for stage
+	class ScopedTimer
+	{
+	public:
+		explicit ScopedTimer(Stage stage);
+		~ScopedTimer();
+
+	private:
+		Stage _stage;
+		QElapsedTimer _timer;
+	};
+
+private:
+	PerfCounters();
+
+	struct stage_counters_t {
+		std::array<std::atomic<qint64>, HistorySize> samples;
+		std::atomic<unsigned int> count;
+	};
+	struct cache_counters_t {
+		std::atomic<quint64> hits, misses;
+	};
+	std::array<stage_counters_t, static_cast<std::size_t>(Stage::Count)> _stages;
+	std::array<cache_counters_t, static_cast<std::size_t>(Cache::Count)> _caches;
+	std::atomic<qint64> _preview_bytes;
+};
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "PngRowReader.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+static constexpr int InputBufferSize = 64*1024;
+
+static quint32 readBigEndian32(const uchar *data)
+{
+	return (quint32(data[0]) << 24) | (quint32(data[1]) << 16) | (quint32(data[2]) << 8) | quint32(data[3]);
+}
+
+static unsigned int readBigEndian16(const uchar *data)
+{
+	return static_cast<unsigned int>(data[0]) << 8 | data[1];
+}
+
+PngRowReader::PngRowReader(const QString &filename)
+        : _file(filename)
+        , _zstream_init(false)
+        , _width(0)
+        , _height(0)
+        , _next_row(0)
+        , _has_key(false)
+        , _idat_remaining(0)
+{
+}
+
+PngRowReader::~PngRowReader()
+{
+	if (_zstream_init)
+		inflateEnd(&_zstream);
+}
+
+bool PngRowReader::open()
+{
+	if (!_file.open(QIODevice::ReadOnly))
+		return error(_file.errorString());
+	if (_file.read(8) != QByteArray("\x89PNG\r\n\x1a\n", 8))
+		return error(tr("not a PNG file"));
+	bool has_header = false;
+	for (;;) {
+		quint32 length;
+		QByteArray type;
+		if (!readChunkHeader(length, type))
+			return false;
+		if (type == "IDAT") {
+			if (!has_header)
+				return error(tr("missing header"));
+			_idat_remaining = length;
+			break;
+		}
+		if (type == "IEND")
+			return error(tr("missing image data"));
+		auto data = _file.read(length);
+		if (static_cast<quint32>(data.size()) != length || _file.read(4).size() != 4) // ignore CRC
+			return error(tr("truncated file"));
+		auto bytes = reinterpret_cast<const uchar *>(data.constData());
+		if (type == "IHDR") {
+			if (length != 13)
+				return error(tr("invalid header"));
+			_width = static_cast<int>(readBigEndian32(bytes));
+			_height = static_cast<int>(readBigEndian32(bytes+4));
+			_bit_depth = bytes[8];
+			_color_type = bytes[9];
+			if (bytes[10] != 0 || bytes[11] != 0)
+				return error(tr("unknown compression or filter method"));
+			if (bytes[12] != 0)
+				return error(tr("interlaced images are not supported"));
+			switch (_color_type) {
+			case 0: _channels = 1; break;
+			case 2: _channels = 3; break;
+			case 3: _channels = 1; break;
+			case 4: _channels = 2; break;
+			case 6: _channels = 4; break;
+			default:
+				return error(tr("invalid color type"));
+			}
+			bool valid_depth = _bit_depth == 8 ||
+			                   (_bit_depth == 16 && _color_type != 3) ||
+			                   ((_bit_depth == 1 || _bit_depth == 2 || _bit_depth == 4) &&
+			                    (_color_type == 0 || _color_type == 3));
+			if (_width <= 0 || _height <= 0 || !valid_depth)
+				return error(tr("invalid header"));
+			has_header = true;
+		}
+		else if (type == "PLTE") {
+			_palette.clear();
+			for (quint32 i = 0; i + 3 <= length; i += 3)
+				_palette.push_back(qRgb(bytes[i], bytes[i+1], bytes[i+2]));
+		}
+		else if (type == "tRNS") {
+			if (_color_type == 3) {
+				for (quint32 i = 0; i < length && i < _palette.size(); ++i)
+					_palette[i] = qRgba(qRed(_palette[i]), qGreen(_palette[i]), qBlue(_palette[i]), bytes[i]);
+			}
+			else if (_color_type == 0 && length >= 2) {
+				_has_key = true;
+				_key[0] = readBigEndian16(bytes);
+			}
+			else if (_color_type == 2 && length >= 6) {
+				_has_key = true;
+				for (int c = 0; c < 3; ++c)
+					_key[c] = readBigEndian16(bytes + 2*c);
+			}
+		}
+	}
+
+	_pixel_bytes = std::max<std::size_t>(1, static_cast<std::size_t>(_channels*_bit_depth/8));
+	_row_bytes = (static_cast<std::size_t>(_width)*static_cast<std::size_t>(_channels*_bit_depth) + 7) / 8;
+	_row.assign(_row_bytes, 0);
+	_previous_row.assign(_row_bytes, 0);
+
+	_zstream.zalloc = Z_NULL;
+	_zstream.zfree = Z_NULL;
+	_zstream.opaque = Z_NULL;
+	_zstream.next_in = Z_NULL;
+	_zstream.avail_in = 0;
+	if (inflateInit(&_zstream) != Z_OK)
+		return error(tr("failed to initialize decompression"));
+	_zstream_init = true;
+	return true;
+}
+
+QSize PngRowReader::size() const
+{
+	return QSize(_width, _height);
+}
+
+QImage PngRowReader::readRows(int count)
+{
+	count = std::min(count, _height - _next_row);
+	if (!_zstream_init || count <= 0)
+		return QImage();
+	QImage image(_width, count, QImage::Format_ARGB32);
+	for (int y = 0; y < count; ++y) {
+		uchar filter;
+		if (!inflateBytes(&filter, 1) ||
+		    !inflateBytes(_row.data(), _row_bytes) ||
+		    !unfilterRow(filter))
+			return QImage();
+		convertRow(reinterpret_cast<QRgb *>(image.scanLine(y)));
+		std::swap(_row, _previous_row);
+		++_next_row;
+	}
+	return image;
+}
+
+const QString &PngRowReader::errorString() const
+{
+	return _error;
+}
+
+bool PngRowReader::error(const QString &message)
+{
+	_error = message;
+	return false;
+}
+
+bool PngRowReader::readChunkHeader(quint32 &length, QByteArray &type)
+{
+	auto header = _file.read(8);
+	if (header.size() != 8)
+		return error(tr("truncated file"));
+	length = readBigEndian32(reinterpret_cast<const uchar *>(header.constData()));
+	type = header.mid(4);
+	return true;
+}
+
+bool PngRowReader::readIdat()
+{
+	while (_idat_remaining == 0) {
+		// image data may be split in several consecutive chunks
+		quint32 length;
+		QByteArray type;
+		if (_file.read(4).size() != 4 || !readChunkHeader(length, type))
+			return false;
+		if (type != "IDAT")
+			return error(tr("truncated image data"));
+		_idat_remaining = length;
+	}
+	_input = _file.read(std::min<qint64>(_idat_remaining, InputBufferSize));
+	if (_input.isEmpty())
+		return error(tr("truncated file"));
+	_idat_remaining -= static_cast<quint32>(_input.size());
+	_zstream.next_in = reinterpret_cast<Bytef *>(_input.data());
+	_zstream.avail_in = static_cast<uInt>(_input.size());
+	return true;
+}
+
+bool PngRowReader::inflateBytes(uchar *data, std::size_t size)
+{
+	_zstream.next_out = data;
+	_zstream.avail_out = static_cast<uInt>(size);
+	while (_zstream.avail_out > 0) {
+		if (_zstream.avail_in == 0 && !readIdat())
+			return false;
+		auto ret = inflate(&_zstream, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END && _zstream.avail_out > 0)
+			return error(tr("truncated image data"));
+		if (ret != Z_OK && ret != Z_STREAM_END)
+			return error(tr("corrupted image data: %1").arg(_zstream.msg ? _zstream.msg : ""));
+	}
+	return true;
+}
+
+bool PngRowReader::unfilterRow(uchar filter)
+{
+	const auto bpp = _pixel_bytes;
+	auto row = _row.data();
+	const auto prev = _previous_row.data();
+	switch (filter) {
+	case 0: // None
+		break;
+	case 1: // Sub
+		for (std::size_t i = bpp; i < _row_bytes; ++i)
+			row[i] += row[i-bpp];
+		break;
+	case 2: // Up
+		for (std::size_t i = 0; i < _row_bytes; ++i)
+			row[i] += prev[i];
+		break;
+	case 3: // Average
+		for (std::size_t i = 0; i < _row_bytes; ++i) {
+			unsigned int left = i >= bpp ? row[i-bpp] : 0;
+			row[i] += static_cast<uchar>((left + prev[i]) / 2);
+		}
+		break;
+	case 4: // Paeth
+		for (std::size_t i = 0; i < _row_bytes; ++i) {
+			int a = i >= bpp ? row[i-bpp] : 0;
+			int b = prev[i];
+			int c = i >= bpp ? prev[i-bpp] : 0;
+			int p = a + b - c;
+			int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+			row[i] += static_cast<uchar>(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+		}
+		break;
+	default:
+		return error(tr("invalid filter type"));
+	}
+	return true;
+}
+
+unsigned int PngRowReader::sample(int x, int channel) const
+{
+	auto index = static_cast<std::size_t>(x*_channels + channel);
+	switch (_bit_depth) {
+	case 8:
+		return _row[index];
+	case 16:
+		return readBigEndian16(&_row[2*index]);
+	default: { // packed gray or palette indices
+		auto bit = index * static_cast<std::size_t>(_bit_depth);
+		auto shift = 8 - _bit_depth - static_cast<int>(bit % 8);
+		return (_row[bit / 8] >> shift) & ((1u << _bit_depth) - 1);
+	}
+	}
+}
+
+void PngRowReader::convertRow(QRgb *dest) const
+{
+	const unsigned int max = (1u << _bit_depth) - 1;
+	auto to8 = [max] (unsigned int value) {
+		return static_cast<int>(value * 255 / max);
+	};
+	for (int x = 0; x < _width; ++x) {
+		switch (_color_type) {
+		case 0: {
+			auto gray = sample(x, 0);
+			auto alpha = _has_key && gray == _key[0] ? 0 : 255;
+			dest[x] = qRgba(to8(gray), to8(gray), to8(gray), alpha);
+			break;
+		}
+		case 2: {
+			auto r = sample(x, 0), g = sample(x, 1), b = sample(x, 2);
+			auto alpha = _has_key && r == _key[0] && g == _key[1] && b == _key[2] ? 0 : 255;
+			dest[x] = qRgba(to8(r), to8(g), to8(b), alpha);
+			break;
+		}
+		case 3: {
+			auto index = sample(x, 0);
+			dest[x] = index < _palette.size() ? _palette[index] : qRgb(0, 0, 0);
+			break;
+		}
+		case 4: {
+			auto gray = to8(sample(x, 0));
+			dest[x] = qRgba(gray, gray, gray, to8(sample(x, 1)));
+			break;
+		}
+		case 6:
+			dest[x] = qRgba(to8(sample(x, 0)), to8(sample(x, 1)), to8(sample(x, 2)), to8(sample(x, 3)));
+			break;
+		}
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PNG_ROW_READER_H
+#define PNG_ROW_READER_H
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QImage>
+
+#include <vector>
+
+#include <zlib.h>
+
+// Sequential PNG decoder returning a few rows at a time, so that only the
+// rows being used are in memory. Interlaced images are not supported.
+class PngRowReader
+{
+	Q_DECLARE_TR_FUNCTIONS(PngRowReader)
+public:
+	explicit PngRowReader(const QString &filename);
+	~PngRowReader();
+
+	// Read the header, false if the file is not a PNG supported by this reader
+	bool open();
+	QSize size() const;
+	// Decode the next rows as Format_ARGB32, returns a null image on error
+	QImage readRows(int count);
+	const QString &errorString() const;
+
+private:
+	bool error(const QString &message);
+	bool readChunkHeader(quint32 &length, QByteArray &type);
+	bool readIdat();
+	bool inflateBytes(uchar *data, std::size_t size);
+	bool unfilterRow(uchar filter);
+	unsigned int sample(int x, int channel) const;
+	void convertRow(QRgb *dest) const;
+
+	QFile _file;
+	z_stream _zstream;
+	bool _zstream_init;
+	int _width, _height;
+	int _bit_depth, _color_type, _channels;
+	int _next_row;
+	std::size_t _row_bytes, _pixel_bytes;
+	std::vector<uchar> _row, _previous_row;
+	std::vector<QRgb> _palette;
+	bool _has_key;
+	unsigned int _key[3]; // transparent color for gray and RGB images
+	quint32 _idat_remaining;
+	QByteArray _input;
+	QString _error;
+};
+
+#endif // PNG_ROW_READER_H
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "PngRowWriter.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+static constexpr int OutputBufferSize = 64*1024;
+static constexpr std::size_t PixelBytes = 4; // 8 bits RGBA
+
+static void appendBigEndian32(QByteArray &data, quint32 value)
+{
+	data.append(static_cast<char>(value >> 24));
+	data.append(static_cast<char>(value >> 16));
+	data.append(static_cast<char>(value >> 8));
+	data.append(static_cast<char>(value));
+}
+
+PngRowWriter::PngRowWriter(const QString &filename, const QSize &size)
+        : _file(filename)
+        , _size(size)
+        , _next_row(0)
+        , _zstream_init(false)
+        , _output(OutputBufferSize, 0)
+        , _output_used(0)
+{
+}
+
+PngRowWriter::~PngRowWriter()
+{
+	if (_zstream_init)
+		deflateEnd(&_zstream);
+}
+
+bool PngRowWriter::open()
+{
+	if (_size.isEmpty())
+		return error(tr("empty image"));
+	if (!_file.open(QIODevice::WriteOnly))
+		return error(_file.errorString());
+	if (_file.write("\x89PNG\r\n\x1a\n", 8) != 8)
+		return error(_file.errorString());
+	QByteArray header;
+	appendBigEndian32(header, static_cast<quint32>(_size.width()));
+	appendBigEndian32(header, static_cast<quint32>(_size.height()));
+	header.append(char(8)); // bit depth
+	header.append(char(6)); // RGBA
+	header.append(char(0)); // deflate
+	header.append(char(0)); // adaptive filtering
+	header.append(char(0)); // not interlaced
+	if (!writeChunk("IHDR", header))
+		return false;
+
+	auto row_bytes = static_cast<std::size_t>(_size.width()) * PixelBytes;
+	_previous_row.assign(row_bytes, 0);
+	for (unsigned int filter = 0; filter < _filtered.size(); ++filter) {
+		_filtered[filter].resize(row_bytes + 1);
+		_filtered[filter][0] = static_cast<uchar>(filter);
+	}
+
+	_zstream.zalloc = Z_NULL;
+	_zstream.zfree = Z_NULL;
+	_zstream.opaque = Z_NULL;
+	if (deflateInit(&_zstream, Z_DEFAULT_COMPRESSION) != Z_OK)
+		return error(tr("failed to initialize compression"));
+	_zstream_init = true;
+	return true;
+}
+
+bool PngRowWriter::writeRows(const QImage &rows)
+{
+	if (!_zstream_init)
+		return error(tr("file is not open"));
+	if (rows.width() != _size.width() || _next_row + rows.height() > _size.height())
+		return error(tr("rows do not fit the image"));
+	auto rgba = rows.convertToFormat(QImage::Format_RGBA8888);
+	for (int y = 0; y < rgba.height(); ++y) {
+		filterRow(rgba.constScanLine(y));
+		// keep the filter giving the smallest sum of signed differences,
+		// as the usual heuristic for compressibility
+		const std::vector<uchar> *best = nullptr;
+		unsigned long best_sum = 0;
+		for (const auto &filtered: _filtered) {
+			unsigned long sum = 0;
+			for (std::size_t i = 1; i < filtered.size(); ++i)
+				sum += static_cast<unsigned long>(std::abs(static_cast<signed char>(filtered[i])));
+			if (!best || sum < best_sum) {
+				best = &filtered;
+				best_sum = sum;
+			}
+		}
+		if (!deflateBytes(best->data(), best->size(), Z_NO_FLUSH))
+			return false;
+		std::copy_n(rgba.constScanLine(y), _previous_row.size(), _previous_row.begin());
+		++_next_row;
+	}
+	return true;
+}
+
+bool PngRowWriter::commit()
+{
+	if (!_zstream_init)
+		return error(tr("file is not open"));
+	if (_next_row != _size.height())
+		return error(tr("missing rows"));
+	if (!deflateBytes(nullptr, 0, Z_FINISH))
+		return false;
+	if (_output_used > 0 && !writeChunk("IDAT", QByteArray::fromRawData(_output.constData(), _output_used)))
+		return false;
+	if (!writeChunk("IEND", QByteArray()))
+		return false;
+	if (!_file.commit())
+		return error(_file.errorString());
+	return true;
+}
+
+const QString &PngRowWriter::errorString() const
+{
+	return _error;
+}
+
+bool PngRowWriter::error(const QString &message)
+{
+	_error = message;
+	return false;
+}
+
+bool PngRowWriter::writeChunk(const char *type, const QByteArray &data)
+{
+	QByteArray chunk;
+	chunk.reserve(data.size() + 12);
+	appendBigEndian32(chunk, static_cast<quint32>(data.size()));
+	chunk.append(type, 4);
+	chunk.append(data);
+	auto crc = crc32(0, reinterpret_cast<const Bytef *>(chunk.constData() + 4),
+	                 static_cast<uInt>(chunk.size() - 4));
+	appendBigEndian32(chunk, static_cast<quint32>(crc));
+	if (_file.write(chunk) != chunk.size())
+		return error(_file.errorString());
+	return true;
+}
+
+bool PngRowWriter::deflateBytes(const uchar *data, std::size_t size, int flush)
+{
+	_zstream.next_in = const_cast<Bytef *>(data);
+	_zstream.avail_in = static_cast<uInt>(size);
+	for (;;) {
+		_zstream.next_out = reinterpret_cast<Bytef *>(_output.data() + _output_used);
+		_zstream.avail_out = static_cast<uInt>(_output.size() - _output_used);
+		auto ret = deflate(&_zstream, flush);
+		if (ret == Z_STREAM_ERROR)
+			return error(tr("compression failed"));
+		_output_used = _output.size() - static_cast<int>(_zstream.avail_out);
+		if (_output_used == _output.size()) {
+			// the buffer is full, write it as one chunk
+			if (!writeChunk("IDAT", _output))
+				return false;
+			_output_used = 0;
+			continue;
+		}
+		if (flush != Z_FINISH || ret == Z_STREAM_END)
+			return true;
+	}
+}
+
+void PngRowWriter::filterRow(const uchar *row)
+{
+	const auto prev = _previous_row.data();
+	const auto size = _previous_row.size();
+	auto none = _filtered[0].data() + 1, sub = _filtered[1].data() + 1, up = _filtered[2].data() + 1;
+	auto average = _filtered[3].data() + 1, paeth = _filtered[4].data() + 1;
+	for (std::size_t i = 0; i < size; ++i) {
+		int a = i >= PixelBytes ? row[i-PixelBytes] : 0;
+		int b = prev[i];
+		int c = i >= PixelBytes ? prev[i-PixelBytes] : 0;
+		int p = a + b - c;
+		int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+		int predictor = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+		none[i] = row[i];
+		sub[i] = static_cast<uchar>(row[i] - a);
+		up[i] = static_cast<uchar>(row[i] - b);
+		average[i] = static_cast<uchar>(row[i] - (a + b) / 2);
+		paeth[i] = static_cast<uchar>(row[i] - predictor);
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PNG_ROW_WRITER_H
+#define PNG_ROW_WRITER_H
+
+#include <QCoreApplication>
+#include <QImage>
+#include <QSaveFile>
+
+#include <array>
+#include <vector>
+
+#include <zlib.h>
+
+// PNG encoder receiving the image a few rows at a time, rows are compressed
+// and written as they come. The file is only replaced by commit.
+class PngRowWriter
+{
+	Q_DECLARE_TR_FUNCTIONS(PngRowWriter)
+public:
+	PngRowWriter(const QString &filename, const QSize &size);
+	~PngRowWriter();
+
+	bool open();
+	// Append rows (in any format) of the image width
+	bool writeRows(const QImage &rows);
+	// Finish the file, fails if some rows were not written
+	bool commit();
+	const QString &errorString() const;
+
+private:
+	bool error(const QString &message);
+	bool writeChunk(const char *type, const QByteArray &data);
+	bool deflateBytes(const uchar *data, std::size_t size, int flush);
+	void filterRow(const uchar *row);
+
+	QSaveFile _file;
+	QSize _size;
+	int _next_row;
+	z_stream _zstream;
+	bool _zstream_init;
+	QByteArray _output;
+	int _output_used;
+	std::vector<uchar> _previous_row;
+	// filter type byte followed by the filtered row, for each filter type
+	std::array<std::vector<uchar>, 5> _filtered;
+	QString _error;
+};
+
+#endif // PNG_ROW_WRITER_H
@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "Preview.h"
+
+#include <QPainter>
+
+#include <numeric>
+
+#include "CP437.h"
+#include "FileLineReader.h"
+#include "PackBundle.h"
+#include "Palette.h"
+#include "Tileset.h"
+
+#include <QtDebug>
+
+Preview::Preview(const TilemapInfo &info)
+        : info(info)
+        , use_colors(true)
+        , layers(1)
+{
+	auto tile_count = info.tileCount();
+	auto &layer = layers.front();
+	layer.tiles.resize(tile_count, 0);
+	layer.source_tilesets.resize(tile_count, 0);
+	layer.fg_colors.resize(tile_count, 15);
+	layer.bg_colors.resize(tile_count, 0);
+}
+
+Preview::Preview(QIODevice *preview_file, const std::vector<const Tileset *> &tilesets)
+        : use_colors(true)
+{
+	if (tilesets.empty())
+		throw std::runtime_error(tr("Empty tileset list").toLocal8Bit().data());
+	info.setTileSize(tilesets[0]->tilesetInfo().tileSize());
+
+	bool ok;
+	FileLineReader reader(preview_file);
+	auto first_line = reader.nextLine();
+	auto parameters = first_line.split(' ');
+	if (parameters.size() != 2)
+		throw reader.parseError(tr("Invalid parameter count"));
+	info.setTilemapWidth(parameters[0].toInt(&ok));
+	if (!ok)
+		throw reader.parseError(tr("Invalid tile width"));
+	info.setTilemapHeight(parameters[1].toInt(&ok));
+	if (!ok)
+		throw reader.parseError(tr("Invalid tile height"));
+	auto tile_count = info.tileCount();
+	while (reader) {
+		auto line = reader.nextLine();
+		auto params = line.splitRef(':');
+		if (params[0] == "tiles") {
+			if (params.size() > 2)
+				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
+			unsigned int layer_index = 0;
+			if (params.size() > 1) {
+				layer_index = params[1].toUInt(&ok);
+				if (!ok) {
+					qCritical().noquote() << reader.formatError(tr("Invalid layer index"));
+					continue;
+				}
+			}
+			if (layer_index >= layers.size())
+				layers.resize(layer_index+1);
+			for (int i = 0; i < info.tilemapHeight(); ++i) {
+				auto line = reader.nextLine();
+				line.resize(info.tilemapWidth(), ' ');
+				for (auto c: line)
+					layers[layer_index].tiles.push_back(CP437::fromUnicode(c.unicode()));
+			}
+		}
+		else if (params[0] == "enumtiles") {
+			if (params.size() > 3)
+				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
+			unsigned int tileset = 0;
+			if (params.size() > 1) {
+				tileset = params[1].toUInt(&ok);
+				if (!ok || tileset >= tilesets.size()) {
+					qCritical().noquote() << reader.formatError(tr("Invalid tileset index"));
+					continue;
+				}
+			}
+			unsigned int layer_index = 0;
+			if (params.size() > 2) {
+				layer_index = params[2].toUInt(&ok);
+				if (!ok) {
+					qCritical().noquote() << reader.formatError(tr("Invalid layer index"));
+					continue;
+				}
+			}
+			if (layer_index >= layers.size())
+				layers.resize(layer_index+1);
+			auto &tiles =  layers[layer_index].tiles;
+			tiles.resize(info.tileCount());
+			std::iota(tiles.begin(), tiles.end(), 0);
+			auto &sources = layers[layer_index].source_tilesets;
+			sources.clear();
+			sources.resize(info.tileCount(), tileset);
+		}
+		else if (params[0] == "foreground" || params[0] == "background") {
+			if (params.size() > 2)
+				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
+			unsigned int layer_index = 0;
+			if (params.size() > 1) {
+				layer_index = params[1].toUInt(&ok);
+				if (!ok) {
+					qCritical().noquote() << reader.formatError(tr("Invalid layer index"));
+					continue;
+				}
+			}
+			if (layer_index >= layers.size())
+				layers.resize(layer_index+1);
+			auto &colors = params[0] == "foreground"
+			               ? layers[layer_index].fg_colors
+			               : layers[layer_index].bg_colors;
+			for (int i = 0; i < info.tilemapHeight(); ++i) {
+				auto line = reader.nextLine();
+				line.resize(info.tilemapWidth(), '0');
+				for (auto c: line) {
+					auto code = c.unicode();
+					uint8_t color = 0;
+					if (code >= '0' && code <= '9')
+						color = static_cast<uint8_t>(code - '0');
+					else if (code >= 'a' && code <= 'f')
+						color = static_cast<uint8_t>(code - 'a' + 10);
+					else if (code >= 'A' && code <= 'F')
+						color = static_cast<uint8_t>(code - 'A' + 10);
+					else {
+						qCritical().noquote() << reader.formatError(tr("Invalid color: %1").arg(c));
+						continue;
+					}
+					colors.push_back(color);
+				}
+			}
+		}
+		else if (params[0] == "tilesets") {
+			if (params.size() > 2)
+				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
+			unsigned int layer_index = 0;
+			if (params.size() > 1) {
+				layer_index = params[1].toUInt(&ok);
+				if (!ok) {
+					qCritical().noquote() << reader.formatError(tr("Invalid layer index"));
+					continue;
+				}
+			}
+			if (layer_index >= layers.size())
+				layers.resize(layer_index+1);
+			for (int i = 0; i < info.tilemapHeight(); ++i) {
+				auto line = reader.nextLine();
+				line.resize(info.tilemapWidth(), '0');
+				for (auto c: line) {
+					auto code = c.unicode();
+					unsigned int index = 0;
+					if (code >= '0' && code <= '9')
+						index = static_cast<unsigned int>(code - '0');
+					else if (code >= 'a' && code <= 'z')
+						index = static_cast<unsigned int>(code - 'a' + 10);
+					else if (code >= 'A' && code <= 'Z')
+						index = static_cast<unsigned int>(code - 'A' + 10);
+					else {
+						qCritical().noquote() << reader.formatError(tr("invalid character: %1").arg(c));
+						continue;
+					}
+					if (index >= tilesets.size()) {
+						qCritical().noquote() << reader.formatError(tr("Tileset index too high"));
+						continue;
+					}
+					layers[layer_index].source_tilesets.push_back(index);
+				}
+			}
+		}
+		else if (params[0] == "tilesizefrom") {
+			if (params.size() > 2)
+				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
+			if (params.size() < 2) {
+				qCritical().noquote() << reader.formatError(tr("Missing tileset index"));
+				continue;
+			}
+			bool ok;
+			unsigned int index = params[1].toUInt(&ok);
+			if (!ok || index >= tilesets.size()) {
+				qCritical().noquote() << reader.formatError(tr("Invalid tileset index"));
+				continue;
+			}
+			info.setTileSize(tilesets[index]->tilesetInfo().tileSize());
+		}
+		else if (params[0] == "tilesize") {
+			if (params.size() > 3)
+				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
+			if (params.size() < 2) {
+				qCritical().noquote() << reader.formatError(tr("Missing tile size"));
+				continue;
+			}
+			bool ok;
+			int width = params[1].toInt(&ok);
+			if (!ok || width <= 0) {
+				qCritical().noquote() << reader.formatError(tr("Invalid tile width"));
+				continue;
+			}
+			info.setTileWidth(width);
+			if (params.size() >= 3) {
+				int height = params[2].toInt(&ok);
+				if (!ok || height <= 0) {
+					qCritical().noquote() << reader.formatError(tr("Invalid tile height"));
+					continue;
+				}
+				info.setTileHeight(height);
+			}
+			else
+				info.setTileHeight(width);
+
+		}
+		else if (line == "nocoloring") {
+			if (params.size() > 1)
+				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
+			use_colors = false;
+		}
+		else {
+			qCritical().noquote() << reader.formatError(tr("Invalid keyword: %1").arg(line));
+			continue;
+		}
+	}
+	for (auto &layer: layers) {
+		layer.tiles.resize(tile_count, 0);
+		layer.source_tilesets.resize(tile_count, 0);
+		layer.fg_colors.resize(tile_count, 15);
+		layer.bg_colors.resize(tile_count, 0);
+	}
+
+}
+
+void Preview::render(QPainter &painter,
+                     const std::vector<const Tileset *> &tilesets,
+                     const Palette &palette) const
+{
+	std::vector<unsigned int> cells(info.tileCount());
+	std::iota(cells.begin(), cells.end(), 0);
+	for (unsigned int layer_index = 0; layer_index < layers.size(); ++layer_index)
+		renderCells(painter, tilesets, nullptr, layer_index, cells, [&] (unsigned int i) {
+			return cellColors(palette, layer_index, i);
+		});
+}
+
+void Preview::render(QPainter &painter,
+                     const std::vector<const Tileset *> &tilesets,
+                     const std::vector<Tileset::images_t> &images,
+                     const Palette &palette) const
+{
+	std::vector<unsigned int> cells(info.tileCount());
+	std::iota(cells.begin(), cells.end(), 0);
+	for (unsigned int layer_index = 0; layer_index < layers.size(); ++layer_index)
+		renderCells(painter, tilesets, &images, layer_index, cells, [&] (unsigned int i) {
+			return cellColors(palette, layer_index, i);
+		});
+}
+
+std::pair<QColor, QColor> Preview::cellColors(const Palette &palette, unsigned int layer_index, unsigned int i) const
+{
+	const auto &layer = layers[layer_index];
+	return std::make_pair(palette.colors[layer.fg_colors[i]], palette.colors[layer.bg_colors[i]]);
+}
+
+bool Preview::drawsCell(unsigned int layer_index, unsigned int i) const
+{
+	const auto &layer = layers[layer_index];
+	auto tile = layer.tiles[i];
+	return !(layer_index > 0 && layer.source_tilesets[i] == 0 && (tile == 0 || tile == ' '));
+}
+
+QDataStream &operator<<(QDataStream &stream, const Preview &preview)
+{
+	stream << preview.info.tileSize() << preview.info.tilemapSize() << preview.use_colors;
+	stream << static_cast<quint32>(preview.layers.size());
+	for (const auto &layer: preview.layers) {
+		PackBundle::writeVector(stream, layer.tiles);
+		PackBundle::writeVector(stream, layer.source_tilesets);
+		PackBundle::writeVector(stream, layer.fg_colors);
+		PackBundle::writeVector(stream, layer.bg_colors);
+	}
+	return stream;
+}
+
+QDataStream &operator>>(QDataStream &stream, Preview &preview)
+{
+	QSize tile_size, tilemap_size;
+	quint32 layer_count;
+	stream >> tile_size >> tilemap_size >> preview.use_colors >> layer_count;
+	// Each layer stores at least the sizes of its four vectors, a larger
+	// count is corrupted data and must not be allocated.
+	const qint64 min_layer_bytes = 4 * sizeof(quint32);
+	if (stream.status() != QDataStream::Ok ||
+	    (stream.device() && static_cast<qint64>(layer_count) > stream.device()->bytesAvailable() / min_layer_bytes)) {
+		stream.setStatus(QDataStream::ReadCorruptData);
+		return stream;
+	}
+	preview.info = TilemapInfo(tile_size, tilemap_size);
+	preview.layers.resize(layer_count);
+	for (auto &layer: preview.layers) {
+		PackBundle::readVector(stream, layer.tiles);
+		PackBundle::readVector(stream, layer.source_tilesets);
+		PackBundle::readVector(stream, layer.fg_colors);
+		PackBundle::readVector(stream, layer.bg_colors);
+		if (layer.tiles.size() != preview.info.tileCount() ||
+		    layer.source_tilesets.size() != preview.info.tileCount() ||
+		    layer.fg_colors.size() != preview.info.tileCount() ||
+		    layer.bg_colors.size() != preview.info.tileCount())
+			stream.setStatus(QDataStream::ReadCorruptData);
+	}
+	return stream;
+}
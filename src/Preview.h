@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <QCoreApplication>
+
+#include <vector>
+
+#include "TilemapInfo.h"
+#include "Tileset.h"
+
+class Palette;
+
+class QDataStream;
+class QIODevice;
+class QPainter;
+
+// Cell arrays of a preview, independent from any widget.
+class Preview
+{
+	Q_DECLARE_TR_FUNCTIONS(Preview)
+public:
+	// Blank preview with a single layer
+	Preview(const TilemapInfo &info = TilemapInfo());
+	// Parse a preview file, throws ParseError
+	Preview(QIODevice *preview_file, const std::vector<const Tileset *> &tilesets);
+
+	void render(QPainter &painter,
+	            const std::vector<const Tileset *> &tilesets,
+	            const Palette &palette) const;
+	// Render using other images for each tileset instead of their current selection
+	void render(QPainter &painter,
+	            const std::vector<const Tileset *> &tilesets,
+	            const std::vector<Tileset::images_t> &images,
+	            const Palette &palette) const;
+	// Render some cells of a layer with one Tileset::renderCells batch per
+	// tileset. colors(i) returns the foreground and background pair used
+	// for cell i. images contains images to use for each tileset, or is
+	// null to use their current selection.
+	template<typename Colors>
+	void renderCells(QPainter &painter,
+	                 const std::vector<const Tileset *> &tilesets,
+	                 const std::vector<Tileset::images_t> *images,
+	                 unsigned int layer_index, const std::vector<unsigned int> &cells,
+	                 Colors &&colors) const
+	{
+		const auto &layer = layers[layer_index];
+		std::vector<std::vector<Tileset::cell_t>> batches(tilesets.size());
+		for (auto i: cells) {
+			if (!drawsCell(layer_index, i))
+				continue;
+			auto cell_colors = colors(i);
+			batches[layer.source_tilesets[i]].push_back({
+				info.tileRect(i), layer.tiles[i], cell_colors.first, cell_colors.second
+			});
+		}
+		for (unsigned int t = 0; t < tilesets.size(); ++t) {
+			if (images)
+				tilesets[t]->renderCellsFrom((*images)[t], painter, batches[t], use_colors);
+			else
+				tilesets[t]->renderCells(painter, batches[t], use_colors);
+		}
+	}
+	// Colors of the cells of a layer, for renderCells
+	std::pair<QColor, QColor> cellColors(const Palette &palette, unsigned int layer_index, unsigned int i) const;
+	// False for null or space tiles from upper layers, they are not drawn.
+	bool drawsCell(unsigned int layer_index, unsigned int i) const;
+
+	TilemapInfo info;
+	bool use_colors;
+	struct layer_t {
+		std::vector<unsigned int> tiles;
+		std::vector<unsigned int> source_tilesets;
+		std::vector<uint8_t> fg_colors;
+		std::vector<uint8_t> bg_colors;
+	};
+	std::vector<layer_t> layers;
+};
+
+QDataStream &operator<<(QDataStream &stream, const Preview &preview);
+QDataStream &operator>>(QDataStream &stream, Preview &preview);
+
+#endif // PREVIEW_H
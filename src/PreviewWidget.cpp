@@ -20,9 +20,10 @@
 #include <QMenu>
 #include <QPainter>
 #include <QPaintEvent>
+#include <QTimer>
 
-#include "CP437.h"
-#include "FileLineReader.h"
+#include "CMVReader.h"
+#include "PerfCounters.h"
 #include "Tileset.h"
 
 #include <QtDebug>
@@ -30,7 +31,7 @@
 constexpr int PreviewWidget::OutlineWidth;
 
 PreviewWidget::PreviewWidget(const std::vector<const Tileset *> &tilesets,
-                             QIODevice *preview_file,
+                             const Preview &preview,
                              const std::vector<std::pair<QString, Palette>> &palettes,
                              const std::vector<std::pair<QString, QColor>> &backgrounds,
                              const std::vector<std::pair<QString, QColor>> &outlines,
@@ -39,221 +40,69 @@ PreviewWidget::PreviewWidget(const std::vector<const Tileset *> &tilesets,
         , _tilesets(tilesets)
         , _background(backgrounds.front().second)
         , _outline(outlines.front().second)
-        , _use_colors(true)
         , _palette(&palettes.front().second)
+        , _preview(preview)
+        , _indexed(_preview, _tilesets)
+        , _highlighting(false)
+        , _dirty(false)
+        , _memory_bytes(0)
+        , _movie_timer(nullptr)
 {
-	// Init tilesets info
 	if (_tilesets.empty())
 		throw std::runtime_error(tr("Empty tileset list").toLocal8Bit().data());
-	_info.setTileSize(_tilesets[0]->tilesetInfo().tileSize());
 	for (auto tileset: _tilesets)
-		connect(tileset, &Tileset::tilesetUpdated, this, &PreviewWidget::buildPreview);
+		connect(tileset, &Tileset::tilesetUpdated, this, &PreviewWidget::invalidatePreview);
 
-	// Read preview file
-	bool ok;
-	FileLineReader reader(preview_file);
-	auto first_line = reader.nextLine();
-	auto parameters = first_line.split(' ');
-	if (parameters.size() != 2)
-		throw reader.parseError(tr("Invalid parameter count"));
-	_info.setTilemapWidth(parameters[0].toInt(&ok));
-	if (!ok)
-		throw reader.parseError(tr("Invalid tile width"));
-	_info.setTilemapHeight(parameters[1].toInt(&ok));
-	if (!ok)
-		throw reader.parseError(tr("Invalid tile height"));
-	auto tile_count = _info.tileCount();
-	while (reader) {
-		auto line = reader.nextLine();
-		auto params = line.splitRef(':');
-		if (params[0] == "tiles") {
-			if (params.size() > 2)
-				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
-			unsigned int layer_index = 0;
-			if (params.size() > 1) {
-				layer_index = params[1].toUInt(&ok);
-				if (!ok) {
-					qCritical().noquote() << reader.formatError(tr("Invalid layer index"));
-					continue;
-				}
-			}
-			if (layer_index >= _layers.size())
-				_layers.resize(layer_index+1);
-			for (int i = 0; i < _info.tilemapHeight(); ++i) {
-				auto line = reader.nextLine();
-				line.resize(_info.tilemapWidth(), ' ');
-				for (auto c: line)
-					_layers[layer_index].tiles.push_back(CP437::fromUnicode(c.unicode()));
-			}
-		}
-		else if (params[0] == "enumtiles") {
-			if (params.size() > 3)
-				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
-			unsigned int tileset = 0;
-			if (params.size() > 1) {
-				tileset = params[1].toUInt(&ok);
-				if (!ok || tileset >= _tilesets.size()) {
-					qCritical().noquote() << reader.formatError(tr("Invalid tileset index"));
-					continue;
-				}
-			}
-			unsigned int layer_index = 0;
-			if (params.size() > 2) {
-				layer_index = params[2].toUInt(&ok);
-				if (!ok) {
-					qCritical().noquote() << reader.formatError(tr("Invalid layer index"));
-					continue;
-				}
-			}
-			if (layer_index >= _layers.size())
-				_layers.resize(layer_index+1);
-			auto &tiles =  _layers[layer_index].tiles;
-			tiles.resize(_info.tileCount());
-			std::iota(tiles.begin(), tiles.end(), 0);
-			auto &sources = _layers[layer_index].source_tilesets;
-			sources.clear();
-			sources.resize(_info.tileCount(), tileset);
-		}
-		else if (params[0] == "foreground" || params[0] == "background") {
-			if (params.size() > 2)
-				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
-			unsigned int layer_index = 0;
-			if (params.size() > 1) {
-				layer_index = params[1].toUInt(&ok);
-				if (!ok) {
-					qCritical().noquote() << reader.formatError(tr("Invalid layer index"));
-					continue;
-				}
-			}
-			if (layer_index >= _layers.size())
-				_layers.resize(layer_index+1);
-			auto &colors = params[0] == "foreground"
-			               ? _layers[layer_index].fg_colors
-			               : _layers[layer_index].bg_colors;
-			for (int i = 0; i < _info.tilemapHeight(); ++i) {
-				auto line = reader.nextLine();
-				line.resize(_info.tilemapWidth(), '0');
-				for (auto c: line) {
-					auto code = c.unicode();
-					uint8_t color = 0;
-					if (code >= '0' && code <= '9')
-						color = static_cast<uint8_t>(code - '0');
-					else if (code >= 'a' && code <= 'f')
-						color = static_cast<uint8_t>(code - 'a' + 10);
-					else if (code >= 'A' && code <= 'F')
-						color = static_cast<uint8_t>(code - 'A' + 10);
-					else {
-						qCritical().noquote() << reader.formatError(tr("Invalid color: %1").arg(c));
-						continue;
-					}
-					colors.push_back(color);
-				}
-			}
-		}
-		else if (params[0] == "tilesets") {
-			if (params.size() > 2)
-				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
-			unsigned int layer_index = 0;
-			if (params.size() > 1) {
-				layer_index = params[1].toUInt(&ok);
-				if (!ok) {
-					qCritical().noquote() << reader.formatError(tr("Invalid layer index"));
-					continue;
-				}
-			}
-			if (layer_index >= _layers.size())
-				_layers.resize(layer_index+1);
-			for (int i = 0; i < _info.tilemapHeight(); ++i) {
-				auto line = reader.nextLine();
-				line.resize(_info.tilemapWidth(), '0');
-				for (auto c: line) {
-					auto code = c.unicode();
-					unsigned int index = 0;
-					if (code >= '0' && code <= '9')
-						index = static_cast<unsigned int>(code - '0');
-					else if (code >= 'a' && code <= 'z')
-						index = static_cast<unsigned int>(code - 'a' + 10);
-					else if (code >= 'A' && code <= 'Z')
-						index = static_cast<unsigned int>(code - 'A' + 10);
-					else {
-						qCritical().noquote() << reader.formatError(tr("invalid character: %1").arg(c));
-						continue;
-					}
-					if (index >= _tilesets.size()) {
-						qCritical().noquote() << reader.formatError(tr("Tileset index too high"));
-						continue;
-					}
-					_layers[layer_index].source_tilesets.push_back(index);
-				}
-			}
-		}
-		else if (params[0] == "tilesizefrom") {
-			if (params.size() > 2)
-				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
-			if (params.size() < 2) {
-				qCritical().noquote() << reader.formatError(tr("Missing tileset index"));
-				continue;
-			}
-			bool ok;
-			unsigned int index = params[1].toUInt(&ok);
-			if (!ok || index >= _tilesets.size()) {
-				qCritical().noquote() << reader.formatError(tr("Invalid tileset index"));
-				continue;
-			}
-			_info.setTileSize(_tilesets[index]->tilesetInfo().tileSize());
-		}
-		else if (params[0] == "tilesize") {
-			if (params.size() > 3)
-				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
-			if (params.size() < 2) {
-				qCritical().noquote() << reader.formatError(tr("Missing tile size"));
-				continue;
-			}
-			bool ok;
-			int width = params[1].toInt(&ok);
-			if (!ok || width <= 0) {
-				qCritical().noquote() << reader.formatError(tr("Invalid tile width"));
-				continue;
-			}
-			_info.setTileWidth(width);
-			if (params.size() >= 3) {
-				int height = params[2].toInt(&ok);
-				if (!ok || height <= 0) {
-					qCritical().noquote() << reader.formatError(tr("Invalid tile height"));
-					continue;
-				}
-				_info.setTileHeight(height);
-			}
-			else
-				_info.setTileHeight(width);
+	setupContextMenu(palettes, backgrounds, outlines);
 
-		}
-		else if (line == "nocoloring") {
-			if (params.size() > 1)
-				qWarning().noquote() << reader.formatError(tr("Unused extras parameters"));
-			_use_colors = false;
-		}
-		else {
-			qCritical().noquote() << reader.formatError(tr("Invalid keyword: %1").arg(line));
-			continue;
-		}
-	}
-	for (auto &layer: _layers) {
-		layer.tiles.resize(tile_count, 0);
-		layer.source_tilesets.resize(tile_count, 0);
-		layer.fg_colors.resize(tile_count, 15);
-		layer.bg_colors.resize(tile_count, 0);
+	buildPreview();
+
+	// Hovering configuration items only looks up these outlines
+	for (unsigned int tileset_index = 0; tileset_index < _tilesets.size(); ++tileset_index) {
+		auto layer_count = static_cast<unsigned int>(_tilesets[tileset_index]->layers().size());
+		for (unsigned int layer_index = 0; layer_index < layer_count; ++layer_index)
+			_highlights.emplace(std::make_pair(tileset_index, layer_index),
+			                    buildHighlight(tileset_index, layer_index));
 	}
+}
+
+PreviewWidget::PreviewWidget(const std::vector<const Tileset *> &tilesets,
+                             std::unique_ptr<CMVReader> movie,
+                             const std::vector<std::pair<QString, Palette>> &palettes,
+                             const std::vector<std::pair<QString, QColor>> &backgrounds,
+                             const std::vector<std::pair<QString, QColor>> &outlines,
+                             QWidget *parent)
+        : PreviewWidget(tilesets,
+                        // Movies use a single layer from the first tileset, starting blank
+                        Preview(TilemapInfo(tilesets.at(0)->tilesetInfo().tileSize(), movie->size())),
+                        palettes, backgrounds, outlines, parent)
+{
+	_movie = std::move(movie);
+	_movie_timer = new QTimer(this);
+	_movie_timer->setInterval(_movie->frameInterval());
+	connect(_movie_timer, &QTimer::timeout, this, &PreviewWidget::nextMovieFrame);
+	if (isVisible())
+		_movie_timer->start();
+	_movie->start();
+}
+
+PreviewWidget::~PreviewWidget()
+{
+	PerfCounters::instance().addPreviewBytes(-_memory_bytes);
+}
 
-	// Setup context menu
+void PreviewWidget::setupContextMenu(const std::vector<std::pair<QString, Palette>> &palettes,
+                                     const std::vector<std::pair<QString, QColor>> &backgrounds,
+                                     const std::vector<std::pair<QString, QColor>> &outlines)
+{
 	auto context_menu = new QMenu(this);
-	if (_use_colors && palettes.size() > 1) {
+	if (_preview.use_colors && palettes.size() > 1) {
 		auto palette_menu = context_menu->addMenu(tr("Palettes"));
 		for (const auto &p: palettes) {
 			auto action = palette_menu->addAction(p.second.makePreview(), p.first);
 			connect(action, &QAction::triggered, [this, palette = &p.second] () {
 				_palette = palette;
-				buildPreview();
+				applyPalette();
 			});
 		}
 	}
@@ -277,7 +126,7 @@ PreviewWidget::PreviewWidget(const std::vector<const Tileset *> &tilesets,
 			auto action = outline_menu->addAction(icon, p.first);
 			connect(action, &QAction::triggered, [this, color = p.second] () {
 				_outline = color;
-				buildHighlight();
+				update();
 			});
 		}
 	}
@@ -288,34 +137,28 @@ PreviewWidget::PreviewWidget(const std::vector<const Tileset *> &tilesets,
 		});
 		setContextMenuPolicy(Qt::CustomContextMenu);
 	}
-
-	buildPreview();
-}
-
-PreviewWidget::~PreviewWidget()
-{
 }
 
 QSize PreviewWidget::sizeHint() const
 {
-	return _info.pixmapSize() + QSize(OutlineWidth*2, OutlineWidth*2); // reserve space for borders
+	return _preview.info.pixmapSize() + QSize(OutlineWidth*2, OutlineWidth*2); // reserve space for borders
 }
 
 const TilemapInfo &PreviewWidget::info() const
 {
-	return _info;
+	return _preview.info;
 }
 
-void PreviewWidget::setHighlight(unsigned int tileset_index, const TileSubset &subset)
+void PreviewWidget::setHighlight(unsigned int tileset_index, unsigned int layer_index)
 {
-	_highlighted_tileset = tileset_index;
-	_highlighted_tiles = std::make_unique<TileSubset>(subset);
-	buildHighlight();
+	_highlighting = true;
+	_highlighted_layer = std::make_pair(tileset_index, layer_index);
+	update();
 }
 
 void PreviewWidget::clearHighlight()
 {
-	_highlighted_tiles.reset();
+	_highlighting = false;
 	update();
 }
 
@@ -327,75 +170,138 @@ void PreviewWidget::paintEvent(QPaintEvent *event)
 	QPainter painter(this);
 	//painter.setClipRegion(event->region());
 
-	QPoint center = painter.viewport().center();
-	QRect rect;
-
 	painter.fillRect(event->rect(), _background);
 
 	painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
 
-	rect.setSize(_preview.size());
-	rect.moveCenter(center);
-	painter.drawPixmap(rect, _preview);
+	auto rect = previewRect();
+	painter.drawImage(rect, _image);
 
-	if (_highlighted_tiles) {
-		rect.setSize(_highlight.size());
-		rect.moveCenter(center);
-		painter.drawPixmap(rect, _highlight);
+	if (_highlighting) {
+		auto it = _highlights.find(_highlighted_layer);
+		if (it == _highlights.end()) // movie cells changed
+			it = _highlights.emplace(_highlighted_layer,
+			                         buildHighlight(_highlighted_layer.first, _highlighted_layer.second)).first;
+		painter.translate(rect.topLeft());
+		painter.fillPath(it->second, _outline);
 	}
 }
 
+void PreviewWidget::showEvent(QShowEvent *event)
+{
+	QWidget::showEvent(event);
+	if (_dirty)
+		buildPreview();
+	if (_movie_timer)
+		_movie_timer->start();
+}
+
+void PreviewWidget::hideEvent(QHideEvent *event)
+{
+	QWidget::hideEvent(event);
+	if (_movie_timer)
+		_movie_timer->stop(); // the decoder waits once its queue is full
+}
+
+void PreviewWidget::invalidatePreview()
+{
+	if (isVisible())
+		buildPreview();
+	else
+		_dirty = true;
+}
+
 void PreviewWidget::buildPreview()
 {
-	_preview = QPixmap(_info.pixmapSize());
-	_preview.fill(Qt::transparent);
-	QPainter painter(&_preview);
-	for (unsigned int layer_index = 0; layer_index < _layers.size(); ++layer_index) {
-		const auto &layer = _layers[layer_index];
-		for (unsigned int i = 0; i < _info.tileCount(); ++i) {
-			auto dest_rect = _info.tileRect(i);
-			auto tileset_index = layer.source_tilesets[i];
-			auto tileset = _tilesets[tileset_index];
-			auto tile = layer.tiles[i];
-			if (layer_index > 0 && tileset_index == 0 && (tile == 0 || tile == ' '))
-				continue; // skip null or space tiles from upper layers
-			if (_use_colors)
-				tileset->render(painter, dest_rect, tile,
-				                _palette->colors[layer.fg_colors[i]],
-				                _palette->colors[layer.bg_colors[i]]);
-			else
-				tileset->render(painter, dest_rect, tile);
+	PerfCounters::ScopedTimer timer(PerfCounters::Stage::PreviewRender);
+	_dirty = false;
+	_indexed.update();
+	if (_image.size() != _preview.info.pixmapSize())
+		_image = QImage(_preview.info.pixmapSize(), QImage::Format_ARGB32_Premultiplied);
+	auto memory_bytes = static_cast<qint64>(_image.sizeInBytes()) + _indexed.memoryBytes();
+	PerfCounters::instance().addPreviewBytes(memory_bytes - _memory_bytes);
+	_memory_bytes = memory_bytes;
+	applyPalette();
+}
 
-		}
-	}
+void PreviewWidget::applyPalette()
+{
+	// only the color lookup is done again
+	_indexed.apply(*_palette, _image);
 	update();
 }
-void PreviewWidget::buildHighlight()
+
+QRect PreviewWidget::previewRect() const
+{
+	QRect rect(QPoint(), _image.size());
+	rect.moveCenter(this->rect().center());
+	return rect;
+}
+
+void PreviewWidget::nextMovieFrame()
 {
-	if (!_highlighted_tiles)
+	CMVReader::frame_t frame;
+	if (!_movie->nextFrame(frame))
+		return; // decoder is late, keep the current frame
+	const auto &info = _preview.info;
+	auto &layer = _preview.layers.front();
+	std::vector<unsigned int> cells;
+	QRegion changed;
+	info.forEachTile([&] (unsigned int i, const QRect &rect) {
+		if (layer.tiles[i] == frame.tiles[i] &&
+		    layer.fg_colors[i] == frame.fg_colors[i] &&
+		    layer.bg_colors[i] == frame.bg_colors[i])
+			return;
+		layer.tiles[i] = frame.tiles[i];
+		layer.fg_colors[i] = frame.fg_colors[i];
+		layer.bg_colors[i] = frame.bg_colors[i];
+		cells.push_back(i);
+		changed += rect;
+	});
+	if (cells.empty())
 		return;
-	_highlight = QPixmap(_info.pixmapSize() + QSize(OutlineWidth*2, OutlineWidth*2));
-	_highlight.fill(Qt::transparent);
-	QPainter painter(&_highlight);
-	painter.setCompositionMode(QPainter::CompositionMode_Source);
-	QPoint origin(OutlineWidth, OutlineWidth);
-	for (const auto &t: {std::make_tuple(OutlineWidth, _outline), std::make_tuple(0, QColor(Qt::transparent))}) {
-		// outline is drawn with a transparent rectangle drawn on top of a bigger colored one.
-		int w = std::get<0>(t);
-		auto color = std::get<1>(t);
-		QMargins margins(w, w, w, w);
-		for (unsigned int layer_index = 0; layer_index < _layers.size(); ++layer_index) {
-			const auto &layer = _layers[layer_index];
-			for (unsigned int i = 0; i < _info.tileCount(); ++i) {
-				auto tile = layer.tiles[i];
-				unsigned int tileset_index = layer.source_tilesets[i];
-				if (layer_index > 0 && tileset_index == 0 && (tile == 0 || tile == ' '))
-					continue; // skip null or space tiles from upper layers
-				if (_highlighted_tileset != tileset_index || !_highlighted_tiles->contains(tile))
-					continue;
-				painter.fillRect(_info.tileRect(i).translated(origin).marginsAdded(margins), color);
-			}
+	_indexed.update(cells);
+	_indexed.apply(*_palette, _image, cells);
+	_highlights.clear(); // highlighted cells may have changed
+	if (_highlighting)
+		update();
+	else
+		update(changed.translated(previewRect().topLeft()));
+}
+
+QPainterPath PreviewWidget::buildHighlight(unsigned int tileset_index, unsigned int layer_index) const
+{
+	PerfCounters::ScopedTimer timer(PerfCounters::Stage::Highlight);
+	const auto &subset = _tilesets[tileset_index]->layers()[layer_index].tiles;
+	// Highlighted cells as rectangles sorted in rows, with horizontal
+	// neighbours merged, as expected by QRegion::setRects
+	std::vector<QRect> rects;
+	_preview.info.forEachTile([&] (unsigned int i, const QRect &rect) {
+		for (unsigned int preview_layer = 0; preview_layer < _preview.layers.size(); ++preview_layer) {
+			const auto &layer = _preview.layers[preview_layer];
+			if (!_preview.drawsCell(preview_layer, i) ||
+			    layer.source_tilesets[i] != tileset_index ||
+			    !subset.contains(layer.tiles[i]))
+				continue;
+			if (!rects.empty() && rects.back().top() == rect.top() &&
+			    rects.back().right() + 1 == rect.left())
+				rects.back().setRight(rect.right());
+			else
+				rects.push_back(rect);
+			break;
 		}
-	}
-	update();
+	});
+	QRegion cells;
+	cells.setRects(rects.data(), static_cast<int>(rects.size()));
+	// The outline is the cell region grown by OutlineWidth, minus the cells.
+	// Tiles are wider than the outline, so translated copies cover the gaps.
+	auto grown = cells;
+	for (int dx: { -OutlineWidth, OutlineWidth })
+		grown += cells.translated(dx, 0);
+	auto grown_rows = grown;
+	for (int dy: { -OutlineWidth, OutlineWidth })
+		grown += grown_rows.translated(0, dy);
+	QPainterPath path;
+	path.addRegion(grown.subtracted(cells));
+	return path;
 }
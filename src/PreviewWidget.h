@@ -17,17 +17,19 @@
 #ifndef PREVIEW_WIDGET_H
 #define PREVIEW_WIDGET_H
 
+#include <QPainterPath>
 #include <QWidget>
 
+#include <map>
 #include <memory>
 
+#include "IndexedPreview.h"
 #include "Palette.h"
-#include "TilemapInfo.h"
+#include "Preview.h"
 
+class CMVReader;
+class QTimer;
 class Tileset;
-class TileSubset;
-
-class QIODevice;
 
 class PreviewWidget : public QWidget
 {
@@ -36,7 +38,13 @@ public:
 	static constexpr int OutlineWidth = 2;
 
 	explicit PreviewWidget(const std::vector<const Tileset *> &tilesets,
-	                       QIODevice *preview_file,
+	                       const Preview &preview,
+	                       const std::vector<std::pair<QString, Palette>> &palettes,
+	                       const std::vector<std::pair<QString, QColor>> &backgrounds,
+	                       const std::vector<std::pair<QString, QColor>> &outlines,
+	                       QWidget *parent = nullptr);
+	explicit PreviewWidget(const std::vector<const Tileset *> &tilesets,
+	                       std::unique_ptr<CMVReader> movie,
 	                       const std::vector<std::pair<QString, Palette>> &palettes,
 	                       const std::vector<std::pair<QString, QColor>> &backgrounds,
 	                       const std::vector<std::pair<QString, QColor>> &outlines,
@@ -50,33 +58,41 @@ public:
 signals:
 
 public slots:
-	void setHighlight(unsigned int tileset_index, const TileSubset &subset);
+	void setHighlight(unsigned int tileset_index, unsigned int layer_index);
 	void clearHighlight();
 
 protected:
 	void paintEvent(QPaintEvent *event) override;
+	void showEvent(QShowEvent *event) override;
+	void hideEvent(QHideEvent *event) override;
 
 private:
+	void setupContextMenu(const std::vector<std::pair<QString, Palette>> &palettes,
+	                      const std::vector<std::pair<QString, QColor>> &backgrounds,
+	                      const std::vector<std::pair<QString, QColor>> &outlines);
 	void buildPreview();
-	void buildHighlight();
+	// Rebuild now if visible, or the next time the widget is shown
+	void invalidatePreview();
+	void applyPalette();
+	// Outline around the cells using tiles from a tileset layer
+	QPainterPath buildHighlight(unsigned int tileset_index, unsigned int layer_index) const;
+	QRect previewRect() const;
+	void nextMovieFrame();
 
 	std::vector<const Tileset *> _tilesets;
 	QColor _background;
 	QColor _outline;
-	bool _use_colors;
 	const Palette *_palette;
-	TilemapInfo _info;
-	struct layer_t {
-		std::vector<unsigned int> tiles;
-		std::vector<unsigned int> source_tilesets;
-		std::vector<uint8_t> fg_colors;
-		std::vector<uint8_t> bg_colors;
-	};
-	std::vector<layer_t> _layers;
-	unsigned int _highlighted_tileset;
-	std::unique_ptr<TileSubset> _highlighted_tiles;
-	QPixmap _preview;
-	QPixmap _highlight;
+	Preview _preview;
+	IndexedPreview _indexed;
+	bool _highlighting;
+	std::pair<unsigned int, unsigned int> _highlighted_layer;
+	std::map<std::pair<unsigned int, unsigned int>, QPainterPath> _highlights;
+	QImage _image;
+	bool _dirty;
+	qint64 _memory_bytes; // reported to PerfCounters
+	std::unique_ptr<CMVReader> _movie;
+	QTimer *_movie_timer;
 };
 
 #endif // PREVIEW_WIDGET_H
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "RenderServer.h"
+
+#include <QBuffer>
+#include <QFutureWatcher>
+#include <QPainter>
+#include <QTcpSocket>
+#include <QUrl>
+#include <QUrlQuery>
+#include <QtConcurrent>
+
+#include "Pack.h"
+#include "Tileset.h"
+
+#include <QtDebug>
+
+static constexpr qint64 MaxHeaderSize = 16*1024;
+
+static RenderServer::response_t errorResponse(int status, const QString &message)
+{
+	return { status, "text/plain; charset=utf-8", message.toUtf8() + '\n' };
+}
+
+static RenderServer::response_t pngResponse(const QImage &image)
+{
+	RenderServer::response_t response = { 200, "image/png", QByteArray() };
+	QBuffer buffer(&response.body);
+	buffer.open(QIODevice::WriteOnly);
+	if (!image.save(&buffer, "PNG"))
+		return errorResponse(500, QStringLiteral("Failed to encode image"));
+	return response;
+}
+
+RenderServer::RenderServer(const Pack &pack, QObject *parent)
+        : QObject(parent)
+        , _pack(pack)
+{
+	for (const auto &tileset: _pack.tilesets())
+		_caches.emplace_back(std::make_unique<CompositeCache>(*tileset));
+	connect(&_server, &QTcpServer::newConnection, this, &RenderServer::newConnection);
+}
+
+RenderServer::~RenderServer()
+{
+	// rendering jobs use the caches
+	for (auto &p: _pending)
+		p.second.waitForFinished();
+}
+
+bool RenderServer::listen(const QHostAddress &address, quint16 port)
+{
+	if (!_server.listen(address, port)) {
+		qCritical().noquote() << tr("Cannot listen on port %1: %2").arg(port).arg(_server.errorString());
+		return false;
+	}
+	qInfo().noquote() << tr("Listening on %1:%2").arg(address.toString()).arg(_server.serverPort());
+	return true;
+}
+
+void RenderServer::newConnection()
+{
+	while (auto socket = _server.nextPendingConnection()) {
+		connect(socket, &QTcpSocket::readyRead, this, [this, socket] () {
+			readRequest(socket);
+		});
+		connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+	}
+}
+
+void RenderServer::readRequest(QTcpSocket *socket)
+{
+	auto header = socket->peek(MaxHeaderSize);
+	auto header_end = header.indexOf("\r\n\r\n");
+	if (header_end == -1) {
+		if (header.size() >= MaxHeaderSize)
+			sendResponse(socket, errorResponse(431, tr("Request header too large")));
+		return; // wait for the complete header
+	}
+	socket->read(header_end + 4);
+	disconnect(socket, &QTcpSocket::readyRead, this, nullptr); // one request per connection
+
+	auto request_line = header.left(header.indexOf("\r\n")).split(' ');
+	if (request_line.size() != 3 || !request_line[2].startsWith("HTTP/")) {
+		sendResponse(socket, errorResponse(400, tr("Invalid request")));
+		return;
+	}
+	if (request_line[0] != "GET") {
+		sendResponse(socket, errorResponse(405, tr("Only GET is supported")));
+		return;
+	}
+	QUrl url(QString::fromUtf8(request_line[1]));
+	auto key = url.toString(QUrl::NormalizePathSegments);
+
+	// Identical requests in progress share the same job
+	auto it = _pending.find(key);
+	if (it == _pending.end()) {
+		auto path = url.path();
+		QUrlQuery query(url);
+		auto future = QtConcurrent::run([this, path, query] () {
+			return handleRequest(path, query);
+		});
+		it = _pending.emplace(key, future).first;
+		auto cleanup = new QFutureWatcher<response_t>(this);
+		connect(cleanup, &QFutureWatcherBase::finished, this, [this, key, cleanup] () {
+			_pending.erase(key);
+			cleanup->deleteLater();
+		});
+		cleanup->setFuture(future);
+	}
+	auto watcher = new QFutureWatcher<response_t>(socket);
+	connect(watcher, &QFutureWatcherBase::finished, socket, [socket, watcher] () {
+		sendResponse(socket, watcher->result());
+	});
+	watcher->setFuture(it->second);
+}
+
+void RenderServer::sendResponse(QTcpSocket *socket, const response_t &response)
+{
+	QByteArray header;
+	header += "HTTP/1.1 " + QByteArray::number(response.status) + " ";
+	switch (response.status) {
+	case 200: header += "OK"; break;
+	case 400: header += "Bad Request"; break;
+	case 404: header += "Not Found"; break;
+	case 405: header += "Method Not Allowed"; break;
+	case 431: header += "Request Header Fields Too Large"; break;
+	default: header += "Internal Server Error"; break;
+	}
+	header += "\r\nContent-Type: " + response.content_type;
+	header += "\r\nContent-Length: " + QByteArray::number(response.body.size());
+	header += "\r\nConnection: close\r\n\r\n";
+	socket->write(header);
+	socket->write(response.body);
+	socket->disconnectFromHost();
+}
+
+RenderServer::response_t RenderServer::handleRequest(const QString &path, const QUrlQuery &query)
+{
+	auto parts = path.split('/', Qt::SkipEmptyParts);
+	bool ok_index, ok_image = true;
+	if (parts.size() == 3 && parts[0] == "tileset" && parts[2].endsWith(".png")) {
+		auto tileset_index = parts[1].toUInt(&ok_index) - 1;
+		auto image_index = parts[2].left(parts[2].size() - 4).toUInt(&ok_image) - 1;
+		if (ok_index && ok_image)
+			return renderTileset(tileset_index, image_index, query);
+	}
+	else if (parts.size() == 2 && parts[0] == "preview" && parts[1].endsWith(".png")) {
+		auto preview_index = parts[1].left(parts[1].size() - 4).toUInt(&ok_index) - 1;
+		if (ok_index)
+			return renderPreview(preview_index, query);
+	}
+	return errorResponse(404, tr("Unknown resource: %1").arg(path));
+}
+
+RenderServer::response_t RenderServer::renderTileset(unsigned int tileset_index, unsigned int image_index,
+                                                     const QUrlQuery &query)
+{
+	const auto &tilesets = _pack.tilesets();
+	if (tileset_index >= tilesets.size())
+		return errorResponse(404, tr("Invalid tileset index"));
+	if (image_index >= tilesets[tileset_index]->outputs().size())
+		return errorResponse(404, tr("Invalid image index"));
+	std::vector<unsigned int> selection;
+	QString error;
+	if (!parseSelection(tileset_index, query.queryItemValue("select"), selection, error))
+		return errorResponse(400, error);
+	return pngResponse(_caches[tileset_index]->images(selection)[image_index]);
+}
+
+RenderServer::response_t RenderServer::renderPreview(unsigned int preview_index, const QUrlQuery &query)
+{
+	const auto &previews = _pack.previews();
+	if (preview_index >= previews.size())
+		return errorResponse(404, tr("Invalid preview index"));
+	const auto &preview = previews[preview_index];
+	if (!preview.movie.isEmpty())
+		return errorResponse(404, tr("Movie previews cannot be rendered"));
+
+	auto tilesets = _pack.constTilesetPointers();
+	auto selections = query.queryItemValue("select").split(';');
+	std::vector<Tileset::images_t> images;
+	for (unsigned int i = 0; i < tilesets.size(); ++i) {
+		std::vector<unsigned int> selection;
+		QString error;
+		if (!parseSelection(i, selections.value(static_cast<int>(i)), selection, error))
+			return errorResponse(400, error);
+		images.push_back(_caches[i]->images(selection));
+	}
+
+	bool ok = true;
+	auto palette_index = query.hasQueryItem("palette")
+	                     ? query.queryItemValue("palette").toUInt(&ok) - 1
+	                     : 0;
+	if (!ok || palette_index >= _pack.palettes().size())
+		return errorResponse(400, tr("Invalid palette index"));
+	auto background_index = query.hasQueryItem("background")
+	                        ? query.queryItemValue("background").toUInt(&ok) - 1
+	                        : 0;
+	if (!ok || background_index >= _pack.backgrounds().size())
+		return errorResponse(400, tr("Invalid background index"));
+
+	QImage image(preview.preview.info.pixmapSize(), QImage::Format_ARGB32_Premultiplied);
+	image.fill(_pack.backgrounds()[background_index].second);
+	{
+		QPainter painter(&image);
+		preview.preview.render(painter, tilesets, images, _pack.palettes()[palette_index].second);
+	}
+	return pngResponse(image);
+}
+
+bool RenderServer::parseSelection(unsigned int tileset_index, const QString &text,
+                                  std::vector<unsigned int> &selection, QString &error) const
+{
+	const auto &layers = _pack.tilesets()[tileset_index]->layers();
+	auto values = text.split(',', Qt::SkipEmptyParts);
+	if (static_cast<std::size_t>(values.size()) > layers.size()) {
+		error = tr("Too many alternatives for tileset %1").arg(tileset_index + 1);
+		return false;
+	}
+	selection.assign(layers.size(), 0);
+	for (int i = 0; i < values.size(); ++i) {
+		bool ok;
+		auto alternative = values[i].toUInt(&ok) - 1;
+		if (!ok || alternative >= layers[static_cast<std::size_t>(i)].alternatives.size()) {
+			error = tr("Invalid alternative for layer %1 of tileset %2").arg(i + 1).arg(tileset_index + 1);
+			return false;
+		}
+		selection[static_cast<std::size_t>(i)] = alternative;
+	}
+	return true;
+}
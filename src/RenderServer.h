@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <QFuture>
+#include <QHostAddress>
+#include <QTcpServer>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "CompositeCache.h"
+
+class Pack;
+class QTcpSocket;
+class QUrlQuery;
+
+// Minimal HTTP server rendering PNG images for arbitrary selections:
+//
+//     GET /tileset/<tileset>/<image>.png?select=<alternatives>
+//     GET /preview/<preview>.png?select=<alternatives>;...&palette=<palette>&background=<background>
+//
+// Every index is numbered from 1: tilesets, previews, palettes, backgrounds,
+// images (the output index, 1 except for TWBT -bg and -top sheets) and
+// alternatives. Alternatives are given for each layer separated by commas,
+// and by semicolons between tilesets for previews. Missing values select
+// the first alternative.
+//
+// Decoded sources and layer composites are kept between requests, and
+// identical requests in progress share the same rendering job.
+class RenderServer: public QObject
+{
+	Q_OBJECT
+public:
+	explicit RenderServer(const Pack &pack, QObject *parent = nullptr);
+	~RenderServer() override;
+
+	bool listen(const QHostAddress &address, quint16 port);
+
+	struct response_t {
+		int status;
+		QByteArray content_type;
+		QByteArray body;
+	};
+
+private:
+	void newConnection();
+	void readRequest(QTcpSocket *socket);
+	static void sendResponse(QTcpSocket *socket, const response_t &response);
+
+	// Called from worker threads
+	response_t handleRequest(const QString &path, const QUrlQuery &query);
+	response_t renderTileset(unsigned int tileset_index, unsigned int image_index, const QUrlQuery &query);
+	response_t renderPreview(unsigned int preview_index, const QUrlQuery &query);
+	bool parseSelection(unsigned int tileset_index, const QString &text,
+	                    std::vector<unsigned int> &selection, QString &error) const;
+
+	const Pack &_pack;
+	QTcpServer _server;
+	std::vector<std::unique_ptr<CompositeCache>> _caches;
+	std::map<QString, QFuture<response_t>> _pending;
+};
+
+#endif // RENDER_SERVER_H
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "Resampler.h"
+
+#include <cmath>
+#include <vector>
+
+static constexpr double Pi = 3.14159265358979323846;
+static constexpr double LanczosLobes = 3.0;
+
+bool Resampler::filterFromString(const QStringRef &name, Filter &filter)
+{
+	if (name == "Nearest")
+		filter = Filter::Nearest;
+	else if (name == "Box")
+		filter = Filter::Box;
+	else if (name == "Lanczos")
+		filter = Filter::Lanczos;
+	else
+		return false;
+	return true;
+}
+
+static double sinc(double x)
+{
+	if (x == 0.0)
+		return 1.0;
+	x *= Pi;
+	return std::sin(x) / x;
+}
+
+static double kernel(Resampler::Filter filter, double x)
+{
+	switch (filter) {
+	case Resampler::Filter::Box:
+		return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+	case Resampler::Filter::Lanczos:
+		return std::abs(x) < LanczosLobes ? sinc(x) * sinc(x / LanczosLobes) : 0.0;
+	case Resampler::Filter::Nearest:
+		break;
+	}
+	Q_UNREACHABLE();
+}
+
+namespace {
+struct contribution_t {
+	std::vector<int> indices;
+	std::vector<float> weights;
+};
+}
+
+// Source pixels and normalized weights contributing to each destination pixel.
+static std::vector<contribution_t> contributions(int src_size, int dest_size, Resampler::Filter filter)
+{
+	double scale = static_cast<double>(dest_size) / src_size;
+	// widen the kernel when downscaling so every source pixel is covered
+	double filter_scale = std::max(1.0, 1.0 / scale);
+	double radius = (filter == Resampler::Filter::Box ? 0.5 : LanczosLobes) * filter_scale;
+	std::vector<contribution_t> contribs(static_cast<std::size_t>(dest_size));
+	for (int i = 0; i < dest_size; ++i) {
+		auto &c = contribs[static_cast<std::size_t>(i)];
+		double center = (i + 0.5) / scale - 0.5;
+		double total = 0.0;
+		std::vector<double> weights;
+		for (int j = static_cast<int>(std::ceil(center - radius)); j <= static_cast<int>(std::floor(center + radius)); ++j) {
+			double w = kernel(filter, (j - center) / filter_scale);
+			if (w == 0.0)
+				continue;
+			c.indices.push_back(qBound(0, j, src_size - 1));
+			weights.push_back(w);
+			total += w;
+		}
+		if (total == 0.0) {
+			c.indices.assign(1, qBound(0, static_cast<int>(std::lround(center)), src_size - 1));
+			weights.assign(1, 1.0);
+			total = 1.0;
+		}
+		for (auto w: weights)
+			c.weights.push_back(static_cast<float>(w / total));
+	}
+	return contribs;
+}
+
+static uchar toChannel(float value)
+{
+	return static_cast<uchar>(qBound(0, static_cast<int>(std::lround(value)), 255));
+}
+
+QImage Resampler::resample(const QImage &image, const QSize &size, Filter filter)
+{
+	if (image.isNull() || size.isEmpty())
+		return QImage();
+	if (image.size() == size)
+		return image;
+	if (filter == Filter::Nearest)
+		return image.scaled(size, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+
+	auto src = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	const int src_w = src.width(), src_h = src.height();
+	const int dest_w = size.width(), dest_h = size.height();
+	auto horizontal = contributions(src_w, dest_w, filter);
+	auto vertical = contributions(src_h, dest_h, filter);
+
+	// horizontal pass into a float buffer (dest_w x src_h, 4 channels)
+	std::vector<float> buffer(static_cast<std::size_t>(dest_w) * static_cast<std::size_t>(src_h) * 4);
+	for (int y = 0; y < src_h; ++y) {
+		auto line = reinterpret_cast<const QRgb *>(src.constScanLine(y));
+		auto out = &buffer[static_cast<std::size_t>(y) * static_cast<std::size_t>(dest_w) * 4];
+		for (int x = 0; x < dest_w; ++x, out += 4) {
+			const auto &c = horizontal[static_cast<std::size_t>(x)];
+			float a = 0, r = 0, g = 0, b = 0;
+			for (std::size_t k = 0; k < c.indices.size(); ++k) {
+				auto p = line[c.indices[k]];
+				auto w = c.weights[k];
+				a += w * qAlpha(p);
+				r += w * qRed(p);
+				g += w * qGreen(p);
+				b += w * qBlue(p);
+			}
+			out[0] = a;
+			out[1] = r;
+			out[2] = g;
+			out[3] = b;
+		}
+	}
+
+	// vertical pass, clamping colors to alpha to stay premultiplied
+	QImage result(size, QImage::Format_ARGB32_Premultiplied);
+	for (int y = 0; y < dest_h; ++y) {
+		const auto &c = vertical[static_cast<std::size_t>(y)];
+		auto line = reinterpret_cast<QRgb *>(result.scanLine(y));
+		for (int x = 0; x < dest_w; ++x) {
+			float sum[4] = { 0, 0, 0, 0 };
+			for (std::size_t k = 0; k < c.indices.size(); ++k) {
+				auto in = &buffer[(static_cast<std::size_t>(c.indices[k]) * static_cast<std::size_t>(dest_w) + static_cast<std::size_t>(x)) * 4];
+				for (int ch = 0; ch < 4; ++ch)
+					sum[ch] += c.weights[k] * in[ch];
+			}
+			auto a = toChannel(sum[0]);
+			line[x] = qRgba(std::min(toChannel(sum[1]), a),
+			                std::min(toChannel(sum[2]), a),
+			                std::min(toChannel(sum[3]), a),
+			                a);
+		}
+	}
+	return result;
+}
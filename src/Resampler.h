@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <QImage>
+#include <QStringRef>
+
+// Separable image resampling used to bring source tiles to the tileset
+// tile size. Images are premultiplied ARGB32.
+class Resampler
+{
+public:
+	enum class Filter
+	{
+		Nearest,
+		Box, // average of the covered source area
+		Lanczos, // 3-lobed Lanczos windowed sinc
+	};
+
+	// Return false if name is not a known filter.
+	static bool filterFromString(const QStringRef &name, Filter &filter);
+
+	static QImage resample(const QImage &image, const QSize &size, Filter filter);
+};
+
+#endif // RESAMPLER_H
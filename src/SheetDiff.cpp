@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "SheetDiff.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <numeric>
+#include <set>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "TilemapInfo.h"
+
+#include <QtDebug>
+
+// Compare 64 bytes per iteration, stopping at the first block with a difference
+static bool equalBytes(const uchar *a, const uchar *b, int count)
+{
+	int i = 0;
+#ifdef __SSE2__
+	for (; i + 64 <= count; i += 64) {
+		auto p = reinterpret_cast<const __m128i *>(a + i);
+		auto q = reinterpret_cast<const __m128i *>(b + i);
+		auto equal = _mm_and_si128(
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(p), _mm_loadu_si128(q)),
+				              _mm_cmpeq_epi8(_mm_loadu_si128(p + 1), _mm_loadu_si128(q + 1))),
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128(p + 2), _mm_loadu_si128(q + 2)),
+				              _mm_cmpeq_epi8(_mm_loadu_si128(p + 3), _mm_loadu_si128(q + 3))));
+		if (_mm_movemask_epi8(equal) != 0xffff)
+			return false;
+	}
+	for (; i + 16 <= count; i += 16) {
+		auto equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)),
+		                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+		if (_mm_movemask_epi8(equal) != 0xffff)
+			return false;
+	}
+#endif
+	return std::memcmp(a + i, b + i, static_cast<std::size_t>(count - i)) == 0;
+}
+
+static bool equalTiles(const QImage &a, const QImage &b, const QRect &rect)
+{
+	const int offset = rect.left() * 4, count = rect.width() * 4;
+	for (int y = rect.top(); y <= rect.bottom(); ++y)
+		if (!equalBytes(a.constScanLine(y) + offset, b.constScanLine(y) + offset, count))
+			return false;
+	return true;
+}
+
+// Pixels right and below the tile grid, when the sheet size is not a
+// multiple of the tilemap size
+static std::vector<QRect> remainderRects(const QImage &image, const TilemapInfo &info)
+{
+	std::vector<QRect> rects;
+	const auto grid = info.pixmapSize();
+	if (image.width() > grid.width())
+		rects.emplace_back(grid.width(), 0, image.width() - grid.width(), image.height());
+	if (image.height() > grid.height())
+		rects.emplace_back(0, grid.height(), grid.width(), image.height() - grid.height());
+	return rects;
+}
+
+SheetDiff::SheetDiff(const QSize &tilemap_size)
+        : _tilemap_size(tilemap_size)
+{
+}
+
+void SheetDiff::setDiffDirectory(const QString &directory)
+{
+	_diff_directory = directory;
+}
+
+bool SheetDiff::compare(const QString &old_path, const QString &new_path)
+{
+	_files.clear();
+	QFileInfo old_info(old_path), new_info(new_path);
+	if (!old_info.exists() || !new_info.exists()) {
+		qCritical().noquote() << tr("Cannot find %1").arg(old_info.exists() ? new_path : old_path);
+		return false;
+	}
+	if (old_info.isDir() != new_info.isDir()) {
+		qCritical().noquote() << tr("Cannot compare a file with a directory");
+		return false;
+	}
+
+	std::vector<std::pair<QString, QString>> filenames;
+	if (old_info.isDir()) {
+		QStringList name_filters;
+		for (const auto &format: QImageReader::supportedImageFormats())
+			name_filters.append("*." + QString::fromLatin1(format));
+		auto list = [&name_filters] (const QString &path) {
+			std::set<QString> files;
+			QDir dir(path);
+			QDirIterator it(path, name_filters, QDir::Files, QDirIterator::Subdirectories);
+			while (it.hasNext())
+				files.insert(dir.relativeFilePath(it.next()));
+			return files;
+		};
+		auto old_files = list(old_path), new_files = list(new_path);
+		std::set<QString> all_files(old_files);
+		all_files.insert(new_files.begin(), new_files.end());
+		for (const auto &file: all_files) {
+			_files.push_back({ file, Status::Identical, {}, false });
+			filenames.emplace_back(old_files.count(file) ? QDir(old_path).filePath(file) : QString(),
+			                       new_files.count(file) ? QDir(new_path).filePath(file) : QString());
+		}
+	}
+	else {
+		_files.push_back({ new_info.fileName(), Status::Identical, {}, false });
+		filenames.emplace_back(old_path, new_path);
+	}
+
+	std::vector<unsigned int> indices(_files.size());
+	std::iota(indices.begin(), indices.end(), 0);
+	QtConcurrent::blockingMap(indices, [this, &filenames] (unsigned int i) {
+		compareFiles(_files[i], filenames[i].first, filenames[i].second);
+	});
+	return std::none_of(_files.begin(), _files.end(), [] (const file_t &file) {
+		return file.status == Status::Error;
+	});
+}
+
+void SheetDiff::compareFiles(file_t &file, const QString &old_filename, const QString &new_filename) const
+{
+	if (old_filename.isEmpty() || new_filename.isEmpty()) {
+		file.status = old_filename.isEmpty() ? Status::Added : Status::Removed;
+		return;
+	}
+	QImage old_image, new_image;
+	for (auto p: { std::make_pair(&old_image, &old_filename), std::make_pair(&new_image, &new_filename) }) {
+		if (!p.first->load(*p.second)) {
+			qCritical().noquote() << tr("Failed to load %1").arg(*p.second);
+			file.status = Status::Error;
+			return;
+		}
+		// compare colors of transparent pixels too
+		if (p.first->format() != QImage::Format_ARGB32)
+			*p.first = p.first->convertToFormat(QImage::Format_ARGB32);
+	}
+	TilemapInfo info(new_image, _tilemap_size);
+	if (old_image.size() != new_image.size()) {
+		file.status = Status::Resized;
+		file.tiles.resize(info.tileCount());
+		std::iota(file.tiles.begin(), file.tiles.end(), 0);
+	}
+	else {
+		info.forEachTile([&] (unsigned int index, const QRect &rect) {
+			if (!equalTiles(old_image, new_image, rect))
+				file.tiles.push_back(index);
+		});
+		for (const auto &rect: remainderRects(new_image, info))
+			if (!equalTiles(old_image, new_image, rect))
+				file.remainder_changed = true;
+		file.status = file.tiles.empty() && !file.remainder_changed ? Status::Identical : Status::Changed;
+	}
+	if (file.status != Status::Identical && !_diff_directory.isEmpty() && !writeDiffSheet(file, new_image))
+		file.status = Status::Error;
+}
+
+bool SheetDiff::writeDiffSheet(const file_t &file, const QImage &image) const
+{
+	// Unchanged tiles are darkened, changed ones are outlined
+	TilemapInfo info(image, _tilemap_size);
+	auto diff = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	QPainter painter(&diff);
+	auto changed = file.tiles.begin();
+	info.forEachTile([&] (unsigned int index, const QRect &rect) {
+		if (changed != file.tiles.end() && *changed == index) {
+			++changed;
+			painter.setPen(Qt::red);
+			painter.setBrush(Qt::NoBrush);
+			painter.drawRect(rect.adjusted(0, 0, -1, -1));
+		}
+		else
+			painter.fillRect(rect, QColor(0, 0, 0, 192));
+	});
+	for (const auto &rect: remainderRects(image, info)) {
+		if (file.remainder_changed) {
+			painter.setPen(Qt::red);
+			painter.setBrush(Qt::NoBrush);
+			painter.drawRect(rect.adjusted(0, 0, -1, -1));
+		}
+		else
+			painter.fillRect(rect, QColor(0, 0, 0, 192));
+	}
+	painter.end();
+	auto filename = QDir(_diff_directory).filePath(file.path);
+	if (!QDir().mkpath(QFileInfo(filename).path()) || !diff.save(filename)) {
+		qCritical().noquote() << tr("Failed to save %1").arg(filename);
+		return false;
+	}
+	return true;
+}
+
+const std::vector<SheetDiff::file_t> &SheetDiff::files() const
+{
+	return _files;
+}
+
+unsigned int SheetDiff::changedFileCount() const
+{
+	return static_cast<unsigned int>(std::count_if(_files.begin(), _files.end(), [] (const file_t &file) {
+		return file.status != Status::Identical;
+	}));
+}
+
+QByteArray SheetDiff::toJson() const
+{
+	static const std::map<Status, const char *> Names = {
+		{ Status::Identical, "identical" },
+		{ Status::Changed, "changed" },
+		{ Status::Resized, "resized" },
+		{ Status::Added, "added" },
+		{ Status::Removed, "removed" },
+		{ Status::Error, "error" },
+	};
+	QJsonArray files;
+	for (const auto &file: _files) {
+		if (file.status == Status::Identical)
+			continue;
+		QJsonObject object;
+		object["file"] = file.path;
+		object["status"] = Names.at(file.status);
+		if (!file.tiles.empty()) {
+			QJsonArray tiles;
+			for (auto tile: file.tiles)
+				tiles.append(static_cast<int>(tile));
+			object["tiles"] = tiles;
+		}
+		if (file.remainder_changed)
+			object["remainder"] = true;
+		files.append(object);
+	}
+	QJsonObject root;
+	root["compared"] = static_cast<int>(_files.size());
+	root["changed"] = static_cast<int>(changedFileCount());
+	root["files"] = files;
+	return QJsonDocument(root).toJson();
+}
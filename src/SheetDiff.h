@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SHEET_DIFF_H
+#define SHEET_DIFF_H
+
+#include <QCoreApplication>
+#include <QSize>
+
+#include <vector>
+
+// Compare assembled sheets tile by tile.
+//
+// Two files, or every image with the same relative path in two directories
+// (e.g. two builds of a pack), are split with the same tilemap grid and
+// the indices of the tiles whose pixels differ are reported. Pixels right
+// and below the grid are compared too, as a single remainder area. Files are
+// compared in parallel, and a tile comparison stops at its first different
+// row.
+class SheetDiff
+{
+	Q_DECLARE_TR_FUNCTIONS(SheetDiff)
+public:
+	enum class Status
+	{
+		Identical,
+		Changed,
+		Resized, // every tile is considered changed
+		Added,
+		Removed,
+		Error, // a file could not be read
+	};
+	struct file_t {
+		QString path; // relative to the compared directories
+		Status status;
+		std::vector<unsigned int> tiles; // changed tile indices
+		// pixels outside the tile grid differ (sheet size not a multiple of the grid)
+		bool remainder_changed;
+	};
+
+	explicit SheetDiff(const QSize &tilemap_size = QSize(16, 16));
+
+	// When set, a diff sheet with changed tiles highlighted over the new
+	// sheet is written in directory for each changed file.
+	void setDiffDirectory(const QString &directory);
+	// Compare two files or two directories, returns false on errors
+	bool compare(const QString &old_path, const QString &new_path);
+
+	const std::vector<file_t> &files() const;
+	unsigned int changedFileCount() const;
+	// Files that are not identical as a JSON document
+	QByteArray toJson() const;
+
+private:
+	void compareFiles(file_t &file, const QString &old_filename, const QString &new_filename) const;
+	bool writeDiffSheet(const file_t &file, const QImage &image) const;
+
+	QSize _tilemap_size;
+	QString _diff_directory;
+	std::vector<file_t> _files;
+};
+
+#endif // SHEET_DIFF_H
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "SheetNormalizer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Clear pixels p for which (p & mask) == key
+static void applyColorKey(QImage &image, QRgb mask, QRgb key)
+{
+	const int width = image.width();
+	for (int y = 0; y < image.height(); ++y) {
+		auto line = reinterpret_cast<QRgb *>(image.scanLine(y));
+		int x = 0;
+#ifdef __SSE2__
+		const __m128i mask4 = _mm_set1_epi32(static_cast<int>(mask));
+		const __m128i key4 = _mm_set1_epi32(static_cast<int>(key));
+		for (; x + 4 <= width; x += 4) {
+			auto p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(line + x));
+			auto keyed = _mm_cmpeq_epi32(_mm_and_si128(p, mask4), key4);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(line + x), _mm_andnot_si128(keyed, p));
+		}
+#endif
+		for (; x < width; ++x)
+			if ((line[x] & mask) == key)
+				line[x] = 0;
+	}
+}
+
+QImage SheetNormalizer::normalize(const QImage &image, const QColor &color_key)
+{
+	if (!color_key.isValid() || image.isNull())
+		return image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+	const QRgb rgb = color_key.rgb() & RGB_MASK;
+	QImage keyed;
+	switch (image.format()) {
+	case QImage::Format_Mono:
+	case QImage::Format_MonoLSB:
+	case QImage::Format_Indexed8: {
+		keyed = image;
+		auto colors = keyed.colorTable();
+		for (auto &color: colors)
+			if ((color & RGB_MASK) == rgb)
+				color = 0;
+		keyed.setColorTable(colors);
+		break;
+	}
+	case QImage::Format_ARGB32_Premultiplied:
+		// converting back and forth would lose precision, only opaque
+		// pixels can match the key
+		keyed = image;
+		applyColorKey(keyed, 0xffffffff, rgb | ~RGB_MASK);
+		return keyed;
+	default:
+		// RGB, 16 bits per channel or other formats are keyed in ARGB32
+		keyed = image.convertToFormat(QImage::Format_ARGB32);
+		applyColorKey(keyed, RGB_MASK, rgb);
+		break;
+	}
+	return keyed.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SHEET_NORMALIZER_H
+#define SHEET_NORMALIZER_H
+
+#include <QColor>
+#include <QImage>
+
+// One-time conversion of decoded source sheets, so that later draws never
+// convert pixels.
+//
+// Pixels of the color key (e.g. the magenta of classic DF tilesets) become
+// transparent, then the sheet is converted to premultiplied ARGB32.
+// Paletted sheets are keyed through their color table.
+class SheetNormalizer
+{
+public:
+	// color_key is ignored if invalid
+	static QImage normalize(const QImage &image, const QColor &color_key);
+};
+
+#endif // SHEET_NORMALIZER_H
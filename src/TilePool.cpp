@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "TilePool.h"
+
+#include "PerfCounters.h"
+
+#include <QtDebug>
+
+TilePool::TilePool()
+        : _compressed(false)
+        , _inserted_count(0)
+        , _inserted_bytes(0)
+        , _stored_bytes(0)
+        , _hot_bytes(0)
+        , _hot_limit(DefaultHotBytes)
+{
+}
+
+void TilePool::setCompressed(bool compressed, qint64 hot_bytes)
+{
+	QMutexLocker lock(&_mutex);
+	assert(_tiles.empty());
+	_compressed = compressed;
+	_hot_limit = hot_bytes;
+}
+
+static uint hashTile(const QImage &tile)
+{
+	uint seed = qHash(tile.width()) ^ (qHash(tile.height()) << 1);
+	if (tile.bytesPerLine() == tile.width() * 4)
+		return qHashBits(tile.constBits(), static_cast<std::size_t>(tile.sizeInBytes()), seed);
+	for (int y = 0; y < tile.height(); ++y)
+		seed = qHashBits(tile.constScanLine(y), static_cast<std::size_t>(tile.width()) * 4, seed);
+	return seed;
+}
+
+TilePool::tile_t TilePool::makeTile(QImage image) const
+{
+	tile_t entry;
+	entry.size = image.size();
+	entry.format = Compositor::compactFormat(image);
+	if (entry.format != Compositor::Format::ARGB32Premultiplied)
+		entry.pixels = Compositor::toFormat(image, entry.format);
+	entry.transparent = entry.format == Compositor::Format::WhiteAlpha8 &&
+	                    entry.pixels.count('\0') == entry.pixels.size();
+	if (_compressed) {
+		// Compression is deterministic, equal tiles have equal compressed data.
+		if (entry.format == Compositor::Format::ARGB32Premultiplied)
+			entry.compressed = qCompress(Compositor::toFormat(image, entry.format), 1);
+		else
+			entry.compressed = qCompress(entry.pixels, 1);
+		entry.pixels.clear();
+	}
+	else if (entry.format == Compositor::Format::ARGB32Premultiplied)
+		entry.image = std::move(image);
+	return entry;
+}
+
+const TilePool::tile_t *TilePool::insert(const QImage &tile)
+{
+	auto image = tile.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+	auto hash = hashTile(image);
+	auto byte_size = static_cast<quint64>(image.width()) * static_cast<quint64>(image.height()) * 4;
+	auto entry = makeTile(std::move(image));
+	QMutexLocker lock(&_mutex);
+	++_inserted_count;
+	_inserted_bytes += byte_size;
+	auto range = _by_content.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		const auto &stored = *it->second;
+		if (stored.format == entry.format && stored.size == entry.size &&
+		    stored.image == entry.image && stored.pixels == entry.pixels &&
+		    stored.compressed == entry.compressed) {
+			PerfCounters::instance().addCacheAccess(PerfCounters::Cache::TilePool, true);
+			return it->second;
+		}
+	}
+	PerfCounters::instance().addCacheAccess(PerfCounters::Cache::TilePool, false);
+	_tiles.push_back(std::move(entry));
+	auto stored = &_tiles.back();
+	_by_content.emplace(hash, stored);
+	_indices.emplace(stored, static_cast<quint32>(_tiles.size() - 1));
+	_stored_bytes += static_cast<quint64>(storedBytes(stored));
+	return stored;
+}
+
+std::vector<const TilePool::tile_t *> TilePool::insertTiles(const std::vector<QImage> &tiles)
+{
+	std::vector<const tile_t *> stored;
+	stored.reserve(tiles.size());
+	for (const auto &tile: tiles)
+		stored.push_back(insert(tile));
+	return stored;
+}
+
+QImage TilePool::image(const tile_t *tile) const
+{
+	// Stored tiles are never modified, only the hot cache needs locking
+	if (tile->compressed.isEmpty()) {
+		if (tile->format == Compositor::Format::ARGB32Premultiplied)
+			return tile->image;
+		return Compositor::toImage(reinterpret_cast<const uchar *>(tile->pixels.constData()),
+		                           tile->size.width() * Compositor::bytesPerPixel(tile->format),
+		                           tile->size, tile->format);
+	}
+	{
+		QMutexLocker lock(&_hot_mutex);
+		auto it = _hot_index.find(tile);
+		if (it != _hot_index.end()) {
+			PerfCounters::instance().addCacheAccess(PerfCounters::Cache::DecompressedTiles, true);
+			_hot.splice(_hot.begin(), _hot, it->second);
+			return it->second->second;
+		}
+	}
+	PerfCounters::instance().addCacheAccess(PerfCounters::Cache::DecompressedTiles, false);
+	auto data = qUncompress(tile->compressed);
+	const int bytes_per_line = tile->size.width() * Compositor::bytesPerPixel(tile->format);
+	QImage image;
+	if (data.size() != bytes_per_line * tile->size.height()) {
+		qCritical().noquote() << tr("Corrupted compressed tile");
+		image = QImage(tile->size, QImage::Format_ARGB32_Premultiplied);
+		image.fill(Qt::transparent);
+	}
+	else
+		image = Compositor::toImage(reinterpret_cast<const uchar *>(data.constData()),
+		                            bytes_per_line, tile->size, tile->format);
+	QMutexLocker lock(&_hot_mutex);
+	if (_hot_index.count(tile)) // decompressed by another thread meanwhile
+		return image;
+	_hot.emplace_front(tile, image);
+	_hot_index.emplace(tile, _hot.begin());
+	_hot_bytes += image.sizeInBytes();
+	while (_hot_bytes > _hot_limit && _hot.size() > 1) {
+		_hot_bytes -= _hot.back().second.sizeInBytes();
+		_hot_index.erase(_hot.back().first);
+		_hot.pop_back();
+	}
+	return image;
+}
+
+void TilePool::composite(QImage &dest, const QPoint &pos, const tile_t *tile, QPainter::CompositionMode mode) const
+{
+	if (tile->transparent && Compositor::transparentSourceIsNoop(mode))
+		return;
+	if (!tile->compressed.isEmpty())
+		Compositor::composite(dest, pos, image(tile), mode);
+	else if (tile->format == Compositor::Format::ARGB32Premultiplied)
+		Compositor::composite(dest, pos, tile->image, mode);
+	else
+		Compositor::composite(dest, pos, reinterpret_cast<const uchar *>(tile->pixels.constData()),
+		                      tile->size.width() * Compositor::bytesPerPixel(tile->format),
+		                      tile->size, tile->format, mode);
+}
+
+qint64 TilePool::storedBytes(const tile_t *tile)
+{
+	if (!tile->compressed.isEmpty())
+		return tile->compressed.size();
+	if (tile->format != Compositor::Format::ARGB32Premultiplied)
+		return tile->pixels.size();
+	return tile->image.sizeInBytes();
+}
+
+void TilePool::save(PackBundle::Writer &bundle) const
+{
+	QMutexLocker lock(&_mutex);
+	bundle.stream() << static_cast<quint32>(_tiles.size());
+	for (const auto &tile: _tiles)
+		bundle.writeImage(image(&tile));
+}
+
+quint32 TilePool::indexOf(const tile_t *tile) const
+{
+	QMutexLocker lock(&_mutex);
+	return _indices.at(tile);
+}
+
+void TilePool::load(PackBundle::Reader &bundle)
+{
+	QMutexLocker lock(&_mutex);
+	assert(_tiles.empty());
+	auto &stream = bundle.stream();
+	quint32 count = 0;
+	stream >> count;
+	for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+		auto image = bundle.readImage();
+		if (image.isNull()) {
+			stream.setStatus(QDataStream::ReadCorruptData);
+			break;
+		}
+		// Bundles store ARGB32 images, compact formats are detected again
+		_tiles.push_back(makeTile(std::move(image)));
+		_indices.emplace(&_tiles.back(), i);
+		_stored_bytes += static_cast<quint64>(storedBytes(&_tiles.back()));
+	}
+}
+
+const TilePool::tile_t *TilePool::tile(quint32 index) const
+{
+	QMutexLocker lock(&_mutex);
+	if (index >= _tiles.size())
+		return nullptr;
+	return &_tiles[index];
+}
+
+void TilePool::clear()
+{
+	QMutexLocker lock(&_mutex);
+	_tiles.clear();
+	_by_content.clear();
+	_indices.clear();
+	_inserted_count = _inserted_bytes = _stored_bytes = 0;
+	QMutexLocker hot_lock(&_hot_mutex);
+	_hot.clear();
+	_hot_index.clear();
+	_hot_bytes = 0;
+}
+
+void TilePool::logStatistics() const
+{
+	QMutexLocker lock(&_mutex);
+	if (_inserted_count == 0)
+		return;
+	qInfo().noquote() << tr("Tile pool: %1 unique tiles out of %2 source tiles, %3 KiB instead of %4 KiB (%5x)")
+	                     .arg(_tiles.size())
+	                     .arg(_inserted_count)
+	                     .arg(_stored_bytes / 1024)
+	                     .arg(_inserted_bytes / 1024)
+	                     .arg(static_cast<double>(_inserted_bytes) / _stored_bytes, 0, 'f', 2);
+}
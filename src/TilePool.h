@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef TILE_POOL_H
+#define TILE_POOL_H
+
+#include <QCoreApplication>
+#include <QImage>
+#include <QMutex>
+
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "Compositor.h"
+#include "PackBundle.h"
+
+// Content-addressed storage for source tiles.
+//
+// Identical tiles (blank tiles, repeated walls, mostly empty TWBT sheets)
+// are only stored once and shared by every source sheet using them. Tile
+// pointers stay valid for the lifetime of the pool. Thread-safe.
+//
+// Tiles of white glyphs or gray art are stored with 1 or 2 bytes per pixel
+// (see Compositor::compactFormat) and composited without expanding them.
+//
+// In compressed mode, inserted tiles are kept compressed and only the tiles
+// being drawn are decompressed, in a cache of recently used tiles.
+class TilePool
+{
+	Q_DECLARE_TR_FUNCTIONS(TilePool)
+public:
+	static constexpr qint64 DefaultHotBytes = 32 * 1024 * 1024;
+
+	// Pixels of a stored tile are accessed with image() or composite()
+	struct tile_t {
+		Compositor::Format format;
+		QSize size;
+		QImage image; // ARGB32 tiles, null in compressed mode
+		QByteArray pixels; // tiles in compact formats, empty in compressed mode
+		QByteArray compressed;
+		bool transparent; // drawing it is skipped when it would not change anything
+	};
+
+	TilePool();
+
+	// Must be set before inserting tiles, hot_bytes bounds the decompressed tiles cache.
+	void setCompressed(bool compressed, qint64 hot_bytes = DefaultHotBytes);
+
+	// Return the stored tile equal to tile, adding it if it is new.
+	const tile_t *insert(const QImage &tile);
+	std::vector<const tile_t *> insertTiles(const std::vector<QImage> &tiles);
+	// Pixels of a tile as a premultiplied ARGB32 image, decompressed if needed
+	QImage image(const tile_t *tile) const;
+	// Draw a tile with Compositor, reading compact formats directly
+	void composite(QImage &dest, const QPoint &pos, const tile_t *tile, QPainter::CompositionMode mode) const;
+	// Memory used by a tile in the pool
+	static qint64 storedBytes(const tile_t *tile);
+
+	// Bundles store unique tiles once, sources refer to them by index.
+	void save(PackBundle::Writer &bundle) const;
+	quint32 indexOf(const tile_t *tile) const;
+	// Tiles read from a bundle are stored like inserted tiles but are not
+	// indexed by content, the pool must be empty.
+	void load(PackBundle::Reader &bundle);
+	const tile_t *tile(quint32 index) const;
+	void clear();
+
+	void logStatistics() const;
+
+private:
+	// Stored form of a premultiplied ARGB32 tile
+	tile_t makeTile(QImage image) const;
+
+	mutable QMutex _mutex;
+	bool _compressed;
+	std::deque<tile_t> _tiles;
+	std::unordered_multimap<uint, const tile_t *> _by_content;
+	std::unordered_map<const tile_t *, quint32> _indices;
+	quint64 _inserted_count, _inserted_bytes, _stored_bytes;
+
+	// decompressed tiles, most recently used first
+	mutable QMutex _hot_mutex;
+	using hot_list_t = std::list<std::pair<const tile_t *, QImage>>;
+	mutable hot_list_t _hot;
+	mutable std::unordered_map<const tile_t *, hot_list_t::iterator> _hot_index;
+	mutable qint64 _hot_bytes;
+	qint64 _hot_limit;
+};
+
+#endif // TILE_POOL_H
@@ -16,8 +16,11 @@
  */
 #include "TileSubset.h"
 
+#include <QDataStream>
 #include <QVector>
 
+#include <algorithm>
+
 #include <QtDebug>
 
 TileSubset::TileSubset()
@@ -26,22 +29,55 @@ TileSubset::TileSubset()
 
 void TileSubset::set(unsigned int min, unsigned int max, bool value)
 {
-	if (max >= _tiles.size())
-		_tiles.resize(max+1, false);
-	std::fill(_tiles.begin() + min, _tiles.begin() + (max+1), value);
+	if (min > max)
+		return;
+	std::vector<range_t> ranges;
+	ranges.reserve(_ranges.size() + 2);
+	for (const auto &r: _ranges) {
+		if (r.second < min || r.first > max) {
+			ranges.push_back(r);
+			continue;
+		}
+		// keep the parts outside [min, max]
+		if (r.first < min)
+			ranges.emplace_back(r.first, min - 1);
+		if (r.second > max)
+			ranges.emplace_back(max + 1, r.second);
+	}
+	if (value)
+		ranges.emplace_back(min, max);
+	std::sort(ranges.begin(), ranges.end());
+	_ranges.clear();
+	for (const auto &r: ranges) {
+		// merge overlapping or adjacent ranges
+		if (!_ranges.empty() && (r.first <= _ranges.back().second || r.first - 1 == _ranges.back().second))
+			_ranges.back().second = std::max(_ranges.back().second, r.second);
+		else
+			_ranges.push_back(r);
+	}
 }
 
 bool TileSubset::contains(unsigned int tile) const
 {
-	if (tile < _tiles.size())
-		return _tiles[tile];
-	return false;
+	auto it = std::upper_bound(_ranges.begin(), _ranges.end(), tile,
+	                           [] (unsigned int tile, const range_t &r) {
+		return tile < r.first;
+	});
+	if (it == _ranges.begin())
+		return false;
+	return tile <= std::prev(it)->second;
 }
 
 unsigned int TileSubset::firstTile() const
 {
-	auto it = std::find(_tiles.begin(), _tiles.end(), true);
-	return static_cast<unsigned int>(std::distance(_tiles.begin(), it));
+	if (_ranges.empty())
+		return 0;
+	return _ranges.front().first;
+}
+
+const std::vector<TileSubset::range_t> &TileSubset::ranges() const
+{
+	return _ranges;
 }
 
 static unsigned int read_tile(QStringRef str)
@@ -71,3 +107,28 @@ TileSubset TileSubset::fromString(const QString &str)
 	return subset;
 }
 
+
+QDataStream &operator<<(QDataStream &stream, const TileSubset &subset)
+{
+	stream << static_cast<quint32>(subset._ranges.size());
+	for (const auto &r: subset._ranges)
+		stream << static_cast<quint32>(r.first) << static_cast<quint32>(r.second);
+	return stream;
+}
+
+QDataStream &operator>>(QDataStream &stream, TileSubset &subset)
+{
+	quint32 size;
+	stream >> size;
+	subset._ranges.clear();
+	for (quint32 i = 0; i < size && stream.status() == QDataStream::Ok; ++i) {
+		quint32 first = 0, last = 0;
+		stream >> first >> last;
+		if (first > last || (!subset._ranges.empty() && first <= subset._ranges.back().second)) {
+			stream.setStatus(QDataStream::ReadCorruptData);
+			break;
+		}
+		subset._ranges.emplace_back(first, last);
+	}
+	return stream;
+}
@@ -20,20 +20,34 @@
 #include <vector>
 #include <QString>
 
+class QDataStream;
+
+// Set of tile indices, stored as sorted disjoint ranges so that large
+// tilemaps do not need one entry per tile.
 class TileSubset
 {
 public:
+	// inclusive first and last tiles
+	using range_t = std::pair<unsigned int, unsigned int>;
+
 	TileSubset();
 
 	void set(unsigned int min, unsigned int max, bool value = true);
 
 	bool contains(unsigned int tile) const;
 	unsigned int firstTile() const;
+	const std::vector<range_t> &ranges() const;
 
 	static TileSubset fromString(const QString &);
 
+	friend QDataStream &operator<<(QDataStream &, const TileSubset &);
+	friend QDataStream &operator>>(QDataStream &, TileSubset &);
+
 private:
-	std::vector<bool> _tiles;
+	std::vector<range_t> _ranges;
 };
 
+QDataStream &operator<<(QDataStream &, const TileSubset &);
+QDataStream &operator>>(QDataStream &, TileSubset &);
+
 #endif // TILESUBSET_H
@@ -16,35 +16,40 @@
  */
 #include "TilemapInfo.h"
 
-#include <QPixmap>
+#include <QImage>
 
 TilemapInfo::TilemapInfo(const QSize &tile_size, const QSize &tilemap_size)
         : tile_size(tile_size)
         , tilemap_size(tilemap_size)
 {
+	updateOffsets();
 }
 
-TilemapInfo::TilemapInfo(const QPixmap &tileset, const QSize &tilemap_size)
+TilemapInfo::TilemapInfo(const QImage &tileset, const QSize &tilemap_size)
         : tile_size(tileset.size().width()/tilemap_size.width(),
                     tileset.size().height()/tilemap_size.height())
         , tilemap_size(tilemap_size)
 {
+	updateOffsets();
 }
 
 
 void TilemapInfo::setTileSize(const QSize &size)
 {
 	tile_size = size;
+	updateOffsets();
 }
 
 void TilemapInfo::setTileWidth(int width)
 {
 	tile_size.setWidth(width);
+	updateOffsets();
 }
 
 void TilemapInfo::setTileHeight(int height)
 {
 	tile_size.setHeight(height);
+	updateOffsets();
 }
 
 const QSize &TilemapInfo::tileSize() const
@@ -55,11 +60,13 @@ const QSize &TilemapInfo::tileSize() const
 void TilemapInfo::setTilemapWidth(int width)
 {
 	tilemap_size.setWidth(width);
+	updateOffsets();
 }
 
 void TilemapInfo::setTilemapHeight(int height)
 {
 	tilemap_size.setHeight(height);
+	updateOffsets();
 }
 
 const QSize &TilemapInfo::tilemapSize() const
@@ -79,14 +86,21 @@ int TilemapInfo::tilemapHeight() const
 
 unsigned int TilemapInfo::tileCount() const
 {
-	return static_cast<unsigned int>(tilemap_size.width() * tilemap_size.height());
+	return static_cast<unsigned int>(column_offsets.size() * row_offsets.size());
 }
 
 QRect TilemapInfo::tileRect(unsigned int index) const
 {
-	int x = static_cast<int>(index) % tilemap_size.width();
-	int y = static_cast<int>(index) / tilemap_size.width();
-	return QRect(QPoint(x*tile_size.width(), y*tile_size.height()), tile_size);
+	if (column_offsets.empty())
+		return QRect();
+	auto width = static_cast<unsigned int>(column_offsets.size());
+	auto x = index % width;
+	auto y = index / width;
+	// tiles past the end are outside the tilemap, as with sheets smaller than expected
+	int top = y < row_offsets.size()
+	          ? row_offsets[y]
+	          : static_cast<int>(y) * tile_size.height();
+	return QRect(QPoint(column_offsets[x], top), tile_size);
 }
 
 QSize TilemapInfo::pixmapSize() const
@@ -94,3 +108,13 @@ QSize TilemapInfo::pixmapSize() const
 	return QSize(tile_size.width() * tilemap_size.width(),
 	             tile_size.height() * tilemap_size.height());
 }
+
+void TilemapInfo::updateOffsets()
+{
+	column_offsets.resize(static_cast<std::size_t>(std::max(0, tilemap_size.width())));
+	for (unsigned int x = 0; x < column_offsets.size(); ++x)
+		column_offsets[x] = static_cast<int>(x) * tile_size.width();
+	row_offsets.resize(static_cast<std::size_t>(std::max(0, tilemap_size.height())));
+	for (unsigned int y = 0; y < row_offsets.size(); ++y)
+		row_offsets[y] = static_cast<int>(y) * tile_size.height();
+}
@@ -20,13 +20,20 @@
 #include <QRect>
 #include <QSize>
 
-class QPixmap;
+#include <algorithm>
+#include <vector>
 
+#include "TileSubset.h"
+
+class QImage;
+
+// Geometry of a tilemap, tile offsets are precomputed for each column and
+// row so that iterating over large tilemaps does not need a division per tile.
 class TilemapInfo
 {
 public:
 	TilemapInfo(const QSize &tile_size = QSize(), const QSize &tilemap_size = QSize(16, 16));
-	TilemapInfo(const QPixmap &tileset, const QSize &tilemap_size = QSize(16, 16));
+	TilemapInfo(const QImage &tileset, const QSize &tilemap_size = QSize(16, 16));
 
 	void setTileSize(const QSize &size);
 	void setTileWidth(int width);
@@ -43,9 +50,44 @@ public:
 	QRect tileRect(unsigned int index) const;
 	QSize pixmapSize() const;
 
+	// Call f(index, rect) for each tile, in index order.
+	template<typename F>
+	void forEachTile(F &&f) const
+	{
+		unsigned int index = 0;
+		for (auto y: row_offsets)
+			for (auto x: column_offsets)
+				f(index++, QRect(QPoint(x, y), tile_size));
+	}
+
+	// Call f(index, rect) for each tile of subset inside the tilemap, in index order.
+	template<typename F>
+	void forEachTile(const TileSubset &subset, F &&f) const
+	{
+		auto count = tileCount();
+		auto width = static_cast<unsigned int>(column_offsets.size());
+		for (const auto &r: subset.ranges()) {
+			if (r.first >= count)
+				break;
+			auto last = std::min(r.second, count - 1);
+			// one division per range, then step through columns and rows
+			auto x = r.first % width, y = r.first / width;
+			for (auto index = r.first; index <= last; ++index) {
+				f(index, QRect(QPoint(column_offsets[x], row_offsets[y]), tile_size));
+				if (++x == width) {
+					x = 0;
+					++y;
+				}
+			}
+		}
+	}
+
 private:
+	void updateOffsets();
+
 	QSize tile_size;
 	QSize tilemap_size;
+	std::vector<int> column_offsets, row_offsets;
 };
 
 #endif // TILEMAP_INFO_H
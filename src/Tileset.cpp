@@ -16,10 +16,16 @@
  */
 #include "Tileset.h"
 
+#include <QCryptographicHash>
 #include <QFile>
 #include <QPainter>
+#include <QtConcurrent>
+
+#include <algorithm>
 
 #include "FileLineReader.h"
+#include "PerfCounters.h"
+#include "SheetNormalizer.h"
 
 #include <QtDebug>
 
@@ -50,8 +56,11 @@ static const std::map<QString, QPainter::CompositionMode, std::less<>> Modes = {
         { "Exclusion", QPainter::CompositionMode_Exclusion },
 };
 
-Tileset::Tileset(QSettings &s, QObject *parent)
+Tileset::Tileset(QSettings &s, TilePool &pool, bool assemble, QObject *parent)
         : QObject(parent)
+        , _pool(&pool)
+        , _assembled_bytes(0)
+        , _source_bytes(0)
 {
 	_output = s.value("output").toString();
 	if (_output.isEmpty())
@@ -64,23 +73,30 @@ Tileset::Tileset(QSettings &s, QObject *parent)
 		_mode = Mode::TWBT;
 	else if (mode == "Creature")
 		_mode = Mode::Creature;
-	else
+	else {
 		qCritical().noquote() << tr("Invalid tileset mode in %1").arg(s.group());
+		_mode = Mode::Normal;
+	}
+	setupMode();
+
+	if (s.contains("color_key")) {
+		_color_key = QColor(s.value("color_key").toString());
+		if (!_color_key.isValid())
+			qCritical().noquote() << tr("Invalid color key in %1").arg(s.group());
+	}
 
 	_info.setTileWidth(s.value("tile_width").toInt());
 	_info.setTileHeight(s.value("tile_height").toInt());
 	_info.setTilemapWidth(s.value("tileset_width", 16).toInt());
 	_info.setTilemapHeight(s.value("tileset_height", 16).toInt());
 
-	for (auto &tileset: _tileset)
-		tileset = QPixmap(_info.pixmapSize());
-
 	auto layer_count = static_cast<unsigned int>(s.beginReadArray("layers"));
 	_layers.resize(layer_count);
 	for (unsigned int i = 0; i < layer_count; ++i) {
 		s.setArrayIndex(static_cast<int>(i));
 		auto &layer = _layers[i];
 		QFile layer_file(s.value("file").toString());
+		_dependencies.push_back(layer_file.fileName());
 		if (!layer_file.open(QIODevice::ReadOnly)) {
 			qCritical().noquote() << tr("Failed to open \"%1\".").arg(layer_file.fileName());
 			continue;
@@ -111,14 +127,17 @@ Tileset::Tileset(QSettings &s, QObject *parent)
 				}
 				auto filename = params.value(1);
 				auto mode = QPainter::CompositionMode_Source;
-				if (params.count() >= 3) {
+				if (params.count() >= 3 && !params[2].isEmpty()) {
 					auto mode_it = Modes.find(params[2]);
 					if (mode_it == Modes.end())
 						qCritical().noquote() << reader.formatError(tr("Invalid composition mode: %1").arg(params[2]));
 					else
 						mode = mode_it->second;
 				}
-				alternative->sources.emplace_back(loadSourceTileset(filename.toString()), mode);
+				auto filter = Resampler::Filter::Nearest;
+				if (params.count() >= 4 && !Resampler::filterFromString(params[3], filter))
+					qCritical().noquote() << reader.formatError(tr("Invalid resampling filter: %1").arg(params[3]));
+				alternative->sources.emplace_back(loadSourceTileset(filename.toString(), filter), mode);
 			}
 			else if (params[0] == "icon") {
 				if (!alternative) {
@@ -128,7 +147,7 @@ Tileset::Tileset(QSettings &s, QObject *parent)
 				bool ok;
 				if (params.count() >= 2) {
 					alternative->icon_tile = params[1].toUInt(&ok);
-					if (!ok || alternative->icon_tile > 255)
+					if (!ok || alternative->icon_tile >= _info.tileCount())
 						qCritical().noquote() << reader.formatError(tr("Invalid icon tile number"));
 				}
 				if (params.count() >= 3) {
@@ -150,14 +169,179 @@ Tileset::Tileset(QSettings &s, QObject *parent)
 	}
 	s.endArray();
 
+	if (!assemble)
+		return;
+	buildTileset();
+}
+
+Tileset::Tileset(PackBundle::Reader &bundle, TilePool &pool, QObject *parent)
+        : QObject(parent)
+        , _pool(&pool)
+        , _assembled_bytes(0)
+        , _source_bytes(0)
+{
+	auto &stream = bundle.stream();
+	quint8 mode = 0;
+	QSize tile_size, tilemap_size;
+	stream >> _output >> mode >> tile_size >> tilemap_size >> _color_key;
+	if (mode > static_cast<quint8>(Mode::Creature))
+		stream.setStatus(QDataStream::ReadCorruptData);
+	_mode = static_cast<Mode>(mode);
+	setupMode();
+	_info = TilemapInfo(tile_size, tilemap_size);
+
+	quint32 source_count = 0;
+	stream >> source_count;
+	for (quint32 i = 0; i < source_count && stream.status() == QDataStream::Ok; ++i) {
+		QString name;
+		quint8 filter = 0;
+		stream >> name >> filter;
+		if (filter > static_cast<quint8>(Resampler::Filter::Lanczos))
+			stream.setStatus(QDataStream::ReadCorruptData);
+		auto &source = _sources[std::make_pair(name, static_cast<Resampler::Filter>(filter))];
+		source.name = name;
+		source.filter = static_cast<Resampler::Filter>(filter);
+		source_tiles_t tiles;
+		for (auto &image_tiles: tiles) {
+			std::vector<quint32> indices;
+			PackBundle::readVector(stream, indices);
+			for (auto index: indices) {
+				auto tile = _pool->tile(index); // bundle tiles are already decoded
+				if (!tile) {
+					stream.setStatus(QDataStream::ReadCorruptData);
+					break;
+				}
+				image_tiles.push_back(tile);
+				_source_bytes.fetch_add(TilePool::storedBytes(tile), std::memory_order_relaxed);
+			}
+			if (!image_tiles.empty() && image_tiles.size() != _info.tileCount())
+				stream.setStatus(QDataStream::ReadCorruptData);
+		}
+		std::call_once(source.loaded, [&source, &tiles] () {
+			source.tiles = std::move(tiles);
+		});
+	}
+
+	quint32 layer_count = 0;
+	stream >> layer_count;
+	for (quint32 i = 0; i < layer_count && stream.status() == QDataStream::Ok; ++i) {
+		_layers.emplace_back();
+		auto &layer = _layers.back();
+		quint32 alternative_count = 0;
+		stream >> layer.tiles >> alternative_count;
+		for (quint32 j = 0; j < alternative_count && stream.status() == QDataStream::Ok; ++j) {
+			layer.alternatives.emplace_back();
+			auto &alternative = layer.alternatives.back();
+			quint32 alt_source_count = 0;
+			stream >> alternative.name
+			       >> alternative.icon_tile
+			       >> alternative.icon_source
+			       >> alt_source_count;
+			for (quint32 k = 0; k < alt_source_count && stream.status() == QDataStream::Ok; ++k) {
+				QString name;
+				quint8 filter = 0;
+				qint32 mode = 0;
+				stream >> name >> filter >> mode;
+				auto it = _sources.find(std::make_pair(name, static_cast<Resampler::Filter>(filter)));
+				if (it == _sources.end()) {
+					stream.setStatus(QDataStream::ReadCorruptData);
+					break;
+				}
+				alternative.sources.emplace_back(&it->second,
+				                                 static_cast<QPainter::CompositionMode>(mode));
+			}
+		}
+		if (layer.alternatives.empty())
+			stream.setStatus(QDataStream::ReadCorruptData);
+		layer.current = 0;
+	}
+	if (stream.status() != QDataStream::Ok)
+		throw std::runtime_error(tr("Corrupted tileset in bundle").toLocal8Bit().data());
+
+	buildTileset();
+}
+
+void Tileset::save(PackBundle::Writer &bundle) const
+{
+	auto &stream = bundle.stream();
+	stream << _output << static_cast<quint8>(_mode) << _info.tileSize() << _info.tilemapSize() << _color_key;
+
+	stream << static_cast<quint32>(_sources.size());
+	for (const auto &p: _sources) {
+		stream << p.second.name << static_cast<quint8>(p.second.filter);
+		for (const auto &image_tiles: sourceTiles(p.second)) {
+			std::vector<quint32> indices;
+			indices.reserve(image_tiles.size());
+			for (auto tile: image_tiles)
+				indices.push_back(_pool->indexOf(tile));
+			PackBundle::writeVector(stream, indices);
+		}
+	}
+
+	stream << static_cast<quint32>(_layers.size());
+	for (const auto &layer: _layers) {
+		stream << layer.tiles << static_cast<quint32>(layer.alternatives.size());
+		for (const auto &alternative: layer.alternatives) {
+			stream << alternative.name
+			       << alternative.icon_tile
+			       << alternative.icon_source
+			       << static_cast<quint32>(alternative.sources.size());
+			for (const auto &p: alternative.sources)
+				stream << p.first->name
+				       << static_cast<quint8>(p.first->filter)
+				       << static_cast<qint32>(p.second);
+		}
+	}
+}
+
+void Tileset::loadSources() const
+{
+	for (const auto &p: _sources)
+		sourceTiles(p.second);
+}
+
+void Tileset::assemble()
+{
 	buildTileset();
 }
 
+const std::vector<QString> &Tileset::dependencies() const
+{
+	return _dependencies;
+}
+
 Tileset::Mode Tileset::mode() const
 {
 	return _mode;
 }
 
+unsigned int Tileset::imageCount() const
+{
+	return _image_count;
+}
+
+void Tileset::setupMode()
+{
+	switch (_mode) {
+	case Mode::Normal:
+		_image_count = 1;
+		_render = &Tileset::normal_render;
+		_colored_render = &Tileset::normal_colored_render;
+		return;
+	case Mode::TWBT:
+		_image_count = 3;
+		_render = &Tileset::twbt_render;
+		_colored_render = &Tileset::twbt_colored_render;
+		return;
+	case Mode::Creature:
+		_image_count = 1;
+		_render = &Tileset::normal_render;
+		_colored_render = &Tileset::normal_render;
+		return;
+	}
+	Q_UNREACHABLE();
+}
+
 const std::vector<Tileset::layer_t> &Tileset::layers() const
 {
 	return _layers;
@@ -174,9 +358,9 @@ void Tileset::selectAlternative(unsigned int layer_index, unsigned int alternati
 	buildTileset();
 }
 
-const QPixmap &Tileset::pixmap(unsigned int layer) const
+const QImage &Tileset::image(unsigned int layer) const
 {
-	assert(layer < PixmapCount);
+	assert(layer < ImageCount);
 	return _tileset[layer];
 }
 
@@ -185,6 +369,11 @@ const TilemapInfo &Tileset::tilesetInfo() const
 	return _info;
 }
 
+const QColor &Tileset::colorKey() const
+{
+	return _color_key;
+}
+
 std::vector<QString> Tileset::outputs() const
 {
 	switch (_mode) {
@@ -213,121 +402,307 @@ QString Tileset::TWBTFileName(QString name, Tileset::TWBTLayer layer)
 	return name;
 }
 
-const Tileset::source_t *Tileset::loadSourceTileset(const QString &name)
+std::vector<QString> Tileset::sourceFileNames(const QString &name) const
 {
-	auto it = _sources.lower_bound(name);
-	if (it == _sources.end() || it->first != name) {
+	switch (_mode) {
+	case Mode::Normal:
+	case Mode::Creature:
+		return { name };
+	case Mode::TWBT:
+		return {
+			TWBTFileName(name, TWBTNormal),
+			TWBTFileName(name, TWBTBackground),
+			TWBTFileName(name, TWBTTop),
+		};
+	}
+	Q_UNREACHABLE();
+}
+
+const Tileset::source_t *Tileset::loadSourceTileset(const QString &name, Resampler::Filter filter)
+{
+	auto key = std::make_pair(name, filter);
+	auto it = _sources.lower_bound(key);
+	if (it == _sources.end() || it->first != key) {
 		it = _sources.emplace_hint(it, std::piecewise_construct,
-		                           std::forward_as_tuple(name),
+		                           std::forward_as_tuple(key),
 		                           std::forward_as_tuple());
-		std::vector<QString> filenames;
-		switch (_mode) {
-		case Mode::Normal:
-		case Mode::Creature:
-			filenames.push_back(name);
-			break;
-		case Mode::TWBT:
-			filenames.push_back(TWBTFileName(name, TWBTNormal));
-			filenames.push_back(TWBTFileName(name, TWBTBackground));
-			filenames.push_back(TWBTFileName(name, TWBTTop));
-			break;
-		}
+		it->second.name = name;
+		it->second.filter = filter;
+		for (const auto &filename: sourceFileNames(name))
+			_dependencies.push_back(filename);
+	}
+	return &it->second;
+}
+
+const Tileset::source_tiles_t &Tileset::sourceTiles(const source_t &source) const
+{
+	std::call_once(source.loaded, [this, &source] () {
+		auto filenames = sourceFileNames(source.name);
 		for (unsigned int i = 0; i < filenames.size(); ++i) {
 			const auto &filename = filenames[i];
 			qDebug().noquote() << tr("Loading %1").arg(filename);
-			if (!it->second[i].load(filename))
+			QImage image;
+			if (!image.load(filename))
 				qCritical().noquote() << tr("Failed to load source image from %1.").arg(filename);
+			else
+				addSourceSheet(source, i, image);
 		}
+	});
+	return source.tiles;
+}
+
+void Tileset::loadSource(const source_t &source, const std::vector<QImage> &sheets) const
+{
+	std::call_once(source.loaded, [this, &source, &sheets] () {
+		for (unsigned int i = 0; i < sheets.size() && i < ImageCount; ++i)
+			if (!sheets[i].isNull())
+				addSourceSheet(source, i, sheets[i]);
+	});
+}
+
+void Tileset::addSourceSheet(const source_t &source, unsigned int image, const QImage &sheet) const
+{
+	source.tiles[image] = _pool->insertTiles(splitSheet(sheet, source.filter));
+	for (auto tile: source.tiles[image])
+		_source_bytes.fetch_add(TilePool::storedBytes(tile), std::memory_order_relaxed);
+}
+
+std::vector<QImage> Tileset::splitSheet(const QImage &image, Resampler::Filter filter) const
+{
+	auto sheet = SheetNormalizer::normalize(image, _color_key);
+	TilemapInfo sheet_info(sheet, _info.tilemapSize());
+	std::vector<QImage> tiles;
+	tiles.reserve(sheet_info.tileCount());
+	sheet_info.forEachTile([&] (unsigned int, const QRect &rect) {
+		tiles.push_back(sheet.copy(rect));
+	});
+	// Resample once here, so that assembly only copies tiles
+	if (sheet_info.tileSize() != _info.tileSize()) {
+		const auto tile_size = _info.tileSize();
+		QtConcurrent::blockingMap(tiles, [tile_size, filter] (QImage &tile) {
+			tile = Resampler::resample(tile, tile_size, filter);
+		});
 	}
-	return &it->second;
+	return tiles;
 }
 
-void Tileset::buildTileset()
+Tileset::images_t Tileset::tileImages(const source_t &source, unsigned int tile, QRect &tile_rect) const
+{
+	images_t images;
+	const auto &tiles = sourceTiles(source);
+	for (unsigned int i = 0; i < ImageCount; ++i) {
+		if (tile >= tiles[i].size())
+			continue;
+		images[i] = _pool->image(tiles[i][tile]);
+		tile_rect = images[i].rect();
+	}
+	return images;
+}
+
+const QByteArray &Tileset::sourceHash(const source_t &source) const
+{
+	std::call_once(source.hashed, [this, &source] () {
+		QCryptographicHash hash(QCryptographicHash::Sha1);
+		for (const auto &filename: sourceFileNames(source.name)) {
+			QFile file(filename);
+			if (file.open(QIODevice::ReadOnly))
+				hash.addData(&file);
+			hash.addData("\0", 1); // keep missing files distinct
+		}
+		source.hash = hash.result();
+	});
+	return source.hash;
+}
+
+qint64 Tileset::decodedBytes() const
+{
+	return _source_bytes.load(std::memory_order_relaxed) + _assembled_bytes;
+}
+
+QByteArray Tileset::alternativeIconKey(const layer_t::alternative_t &alternative) const
 {
-	QPainter painter;
-	for (unsigned int i = 0; i < PixmapCount; ++i) {
-		_tileset[i].fill(Qt::transparent);
-		painter.begin(&_tileset[i]);
-		for (const auto &layer: _layers) {
-			for (unsigned int tile = 0; tile < _info.tileCount(); ++tile) {
-				if (!layer.tiles.contains(tile))
+	if (alternative.icon_source >= alternative.sources.size())
+		return QByteArray();
+	auto source = alternative.sources[alternative.icon_source].first;
+	if (!source)
+		return QByteArray();
+	QByteArray key;
+	QDataStream stream(&key, QIODevice::WriteOnly);
+	stream << sourceHash(*source)
+	       << static_cast<quint8>(source->filter)
+	       << static_cast<quint8>(_mode)
+	       << alternative.icon_tile
+	       << _info.tileSize()
+	       << _info.tilemapSize()
+	       << _color_key;
+	return QCryptographicHash::hash(key, QCryptographicHash::Sha1);
+}
+
+Tileset::images_t Tileset::blankImages() const
+{
+	images_t images;
+	for (unsigned int i = 0; i < _image_count; ++i) {
+		images[i] = QImage(_info.pixmapSize(), QImage::Format_ARGB32_Premultiplied);
+		images[i].fill(Qt::transparent);
+	}
+	return images;
+}
+
+void Tileset::compositeLayer(images_t &images, unsigned int layer_index, unsigned int alternative) const
+{
+	const auto &layer = _layers[layer_index];
+	const auto &sources = layer.alternatives[alternative].sources;
+	for (unsigned int i = 0; i < _image_count; ++i) {
+		_info.forEachTile(layer.tiles, [&] (unsigned int tile, const QRect &rect) {
+			for (const auto &p: sources) {
+				const auto &tiles = sourceTiles(*p.first)[i];
+				if (tile >= tiles.size())
 					continue;
-				const auto &current = layer.alternatives[layer.current];
-				for (const auto &p: current.sources) {
-					const auto &source = (*p.first)[i];
-					if (source.isNull())
-						continue;
-					TilemapInfo source_info(source, _info.tilemapSize());
-					painter.setCompositionMode(p.second);
-					painter.drawPixmap(_info.tileRect(tile), source, source_info.tileRect(tile));
-				}
+				// tiles are already scaled
+				_pool->composite(images[i], rect.topLeft(), tiles[tile], p.second);
 			}
-		}
-		painter.end();
+		});
+	}
+}
+
+void Tileset::buildTileset()
+{
+	std::vector<unsigned int> selection;
+	selection.reserve(_layers.size());
+	for (const auto &layer: _layers)
+		selection.push_back(layer.current);
+	auto it = std::find_if(_assembled.begin(), _assembled.end(), [&selection] (const auto &entry) {
+		return entry.first == selection;
+	});
+	PerfCounters::instance().addCacheAccess(PerfCounters::Cache::Assembled, it != _assembled.end());
+	if (it != _assembled.end()) {
+		_assembled.splice(_assembled.begin(), _assembled, it);
+		_tileset = _assembled.front().second;
+		emit tilesetUpdated();
+		return;
+	}
+
+	{
+		PerfCounters::ScopedTimer timer(PerfCounters::Stage::Build);
+		auto images = blankImages();
+		for (unsigned int i = 0; i < _layers.size(); ++i)
+			compositeLayer(images, i, _layers[i].current);
+		_tileset = images;
+	}
+	_assembled.emplace_front(std::move(selection), _tileset);
+	for (const auto &image: _tileset)
+		_assembled_bytes += image.sizeInBytes();
+	// Always keep the current selection
+	while (_assembled_bytes > AssembledCacheBytes && _assembled.size() > 1) {
+		for (const auto &image: _assembled.back().second)
+			_assembled_bytes -= image.sizeInBytes();
+		_assembled.pop_back();
 	}
 	emit tilesetUpdated();
 }
 
-void Tileset::normal_render(QPainter &p, const QRect &dest,
-                            const std::array<QPixmap, PixmapCount> &pixmaps,
-                            unsigned int tile) const
+void Tileset::renderCells(QPainter &painter, const std::vector<cell_t> &cells, bool use_colors) const
+{
+	renderCellsFrom(_tileset, painter, cells, use_colors);
+}
+
+void Tileset::renderCellsFrom(const images_t &images, QPainter &painter,
+                              const std::vector<cell_t> &cells, bool use_colors) const
+{
+	draws_t draws;
+	draws.reserve(cells.size());
+	for (const auto &cell: cells)
+		draws.push_back({ cell.dest, _info.tileRect(cell.tile), cell.foreground, cell.background });
+	render(painter, images, draws, use_colors);
+}
+
+QImage Tileset::renderAlternativeIcon(const layer_t::alternative_t &alternative) const
+{
+	if (alternative.icon_source >= alternative.sources.size())
+		return QImage();
+	auto source = alternative.sources[alternative.icon_source].first;
+	if (!source)
+		return QImage();
+	QRect tile_rect;
+	auto tiles = tileImages(*source, alternative.icon_tile, tile_rect);
+	QImage icon(_info.tileSize(), QImage::Format_ARGB32_Premultiplied);
+	icon.fill(Qt::transparent);
+	{
+		QPainter painter(&icon);
+		render(painter, tiles, { { icon.rect(), tile_rect, QColor(), QColor() } }, false);
+	}
+	return icon;
+}
+
+void Tileset::render(QPainter &painter, const images_t &images, const draws_t &draws, bool use_colors) const
+{
+	if (draws.empty())
+		return;
+	(this->*(use_colors ? _colored_render : _render))(painter, images, draws);
+}
+
+void Tileset::normal_render(QPainter &p, const images_t &images, const draws_t &draws) const
 {
-	auto src_rect = _info.tileRect(tile);
 	p.setCompositionMode(QPainter::CompositionMode_SourceOver);
-	p.drawPixmap(dest, pixmaps[0], src_rect);
+	for (const auto &d: draws)
+		p.drawImage(d.dest, images[0], d.src);
 }
 
-void Tileset::normal_render(QPainter &p, const QRect &dest,
-                            const std::array<QPixmap, PixmapCount> &pixmaps,
-                            unsigned int tile,
-                            const QColor &foreground, const QColor &background) const
+// Cells do not overlap, so each step can be applied to every cell before
+// the next one, with a single composition mode change.
+void Tileset::normal_colored_render(QPainter &p, const images_t &images, const draws_t &draws) const
 {
-	const auto &pixmap = pixmaps[0];
-	auto src_rect = _info.tileRect(tile);
+	const auto &image = images[0];
 	p.setCompositionMode(QPainter::CompositionMode_Source);
-	p.drawPixmap(dest, pixmap, src_rect);
+	for (const auto &d: draws)
+		p.drawImage(d.dest, image, d.src);
 	p.setCompositionMode(QPainter::CompositionMode_Multiply);
-	p.fillRect(dest, foreground);
+	for (const auto &d: draws)
+		p.fillRect(d.dest, d.foreground);
 	p.setCompositionMode(QPainter::CompositionMode_DestinationIn); // multiply has overwritten alpha channel?
-	p.drawPixmap(dest, pixmap, src_rect);
+	for (const auto &d: draws)
+		p.drawImage(d.dest, image, d.src);
 	p.setCompositionMode(QPainter::CompositionMode_DestinationOver);
-	p.fillRect(dest, background);
+	for (const auto &d: draws)
+		p.fillRect(d.dest, d.background);
 }
 
-void Tileset::twbt_render(QPainter &p, const QRect &dest,
-                          const std::array<QPixmap, PixmapCount> &pixmaps,
-                          unsigned int tile) const
+void Tileset::twbt_render(QPainter &p, const images_t &images, const draws_t &draws) const
 {
-	auto src_rect = _info.tileRect(tile);
 	p.setCompositionMode(QPainter::CompositionMode_SourceOver);
-	for (auto layer: { TWBTBackground, TWBTNormal, TWBTTop }) {
-		p.drawPixmap(dest, pixmaps[layer], src_rect);
-	}
+	for (auto layer: { TWBTBackground, TWBTNormal, TWBTTop })
+		for (const auto &d: draws)
+			p.drawImage(d.dest, images[layer], d.src);
 }
 
-void Tileset::twbt_render(QPainter &p, const QRect &dest,
-                          const std::array<QPixmap, PixmapCount> &pixmaps,
-                          unsigned int tile,
-                          const QColor &foreground, const QColor &background) const
+void Tileset::twbt_colored_render(QPainter &p, const images_t &images, const draws_t &draws) const
 {
+	// Colored layers are prepared in a temporary image covering every
+	// cell, it is transparent outside them so it can be drawn at once.
+	QRect bounds;
+	for (const auto &d: draws)
+		bounds |= d.dest;
+	QImage temp_image(bounds.size(), QImage::Format_ARGB32_Premultiplied);
+	temp_image.fill(Qt::transparent);
 	QPainter temp_painter;
-	QPixmap temp_pixmap(dest.size());
-	temp_pixmap.fill(Qt::transparent);
-	QRect rect = temp_pixmap.rect();
-	auto src_rect = _info.tileRect(tile);
-	for (const auto &t: { std::make_tuple(TWBTBackground, background),
-	                      std::make_tuple(TWBTNormal, foreground)}) {
-		const auto &pixmap = pixmaps[std::get<0>(t)];
-		temp_painter.begin(&temp_pixmap);
+	for (const auto &t: { std::make_tuple(TWBTBackground, &draw_t::background),
+	                      std::make_tuple(TWBTNormal, &draw_t::foreground)}) {
+		const auto &image = images[std::get<0>(t)];
+		temp_painter.begin(&temp_image);
+		temp_painter.translate(-bounds.topLeft());
 		temp_painter.setCompositionMode(QPainter::CompositionMode_Source);
-		temp_painter.drawPixmap(rect, pixmap, src_rect);
+		for (const auto &d: draws)
+			temp_painter.drawImage(d.dest, image, d.src);
 		temp_painter.setCompositionMode(QPainter::CompositionMode_Multiply);
-		temp_painter.fillRect(rect, std::get<1>(t));
+		for (const auto &d: draws)
+			temp_painter.fillRect(d.dest, d.*std::get<1>(t));
 		temp_painter.setCompositionMode(QPainter::CompositionMode_DestinationIn); // multiply has overwritten alpha channel?
-		temp_painter.drawPixmap(rect, pixmap, src_rect);
+		for (const auto &d: draws)
+			temp_painter.drawImage(d.dest, image, d.src);
 		temp_painter.end();
 		p.setCompositionMode(QPainter::CompositionMode_SourceOver);
-		p.drawPixmap(dest, temp_pixmap, rect);
+		p.drawImage(bounds.topLeft(), temp_image);
 	}
-	p.drawPixmap(dest, pixmaps[TWBTTop], src_rect);
+	for (const auto &d: draws)
+		p.drawImage(d.dest, images[TWBTTop], d.src);
 }
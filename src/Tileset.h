@@ -19,21 +19,57 @@
 
 #include <QObject>
 
+#include <QImage>
 #include <QPainter>
-#include <QPixmap>
 #include <QSettings>
 
+#include <atomic>
+#include <list>
+#include <mutex>
+
+#include "PackBundle.h"
+#include "Resampler.h"
 #include "TilemapInfo.h"
+#include "TilePool.h"
 #include "TileSubset.h"
 
 class Tileset: public QObject
 {
 	Q_OBJECT
 public:
-	static constexpr std::size_t PixmapCount = 3;
-	using source_t = std::array<QPixmap, PixmapCount>;
+	static constexpr std::size_t ImageCount = 3;
+	// Memory used by the images of previous selections kept for selectAlternative
+	static constexpr qint64 AssembledCacheBytes = 64 * 1024 * 1024;
+	using images_t = std::array<QImage, ImageCount>;
+	// Tiles from the pool for each image, empty if the image is missing.
+	using source_tiles_t = std::array<std::vector<const TilePool::tile_t *>, ImageCount>;
+
+	// Source images are decoded on first use, from any thread, split in
+	// tiles resampled to the tileset tile size and shared through the pack
+	// tile pool.
+	struct source_t {
+		QString name;
+		Resampler::Filter filter;
+		mutable source_tiles_t tiles;
+		mutable std::once_flag loaded;
+		mutable QByteArray hash;
+		mutable std::once_flag hashed;
+	};
 
-	Tileset(QSettings &s, QObject *parent = nullptr);
+	// Sources are not decoded until the tileset is assembled, parse only
+	// when assemble is false (image() must not be used before assemble()).
+	Tileset(QSettings &s, TilePool &pool, bool assemble = true, QObject *parent = nullptr);
+	// Load a tileset saved in a bundle, throws std::runtime_error on corrupted data
+	Tileset(PackBundle::Reader &bundle, TilePool &pool, QObject *parent = nullptr);
+
+	// Sources refer to pool tiles, the pool must be saved first
+	void save(PackBundle::Writer &bundle) const;
+	// Decode every source (not only the selected alternatives)
+	void loadSources() const;
+	// Assemble a tileset created without assembling
+	void assemble();
+	// files read when parsing the tileset (layers and sources)
+	const std::vector<QString> &dependencies() const;
 
 	enum class Mode
 	{
@@ -42,6 +78,8 @@ public:
 		Creature, // do not apply colors when rendering
 	};
 	Mode mode() const;
+	// Images used by the mode, the others are always null
+	unsigned int imageCount() const;
 
 	struct layer_t {
 		TileSubset tiles;
@@ -56,6 +94,7 @@ public:
 
 	const std::vector<layer_t> &layers() const;
 
+	// Previously assembled selections are reused instead of being rebuilt.
 	void selectAlternative(unsigned int layer, unsigned int alternative);
 
 	enum TWBTLayer: unsigned int
@@ -64,78 +103,100 @@ public:
 		TWBTBackground,
 		TWBTTop,
 	};
-	static_assert(TWBTTop < PixmapCount, "Not enough pixmaps for TWBT");
+	static_assert(TWBTTop < ImageCount, "Not enough images for TWBT");
 
-	const QPixmap &pixmap(unsigned int layer = 0) const;
+	const QImage &image(unsigned int layer = 0) const;
 	const TilemapInfo &tilesetInfo() const;
+	// Color made transparent in source sheets, invalid if none
+	const QColor &colorKey() const;
 	std::vector<QString> outputs() const;
 
 	static QString TWBTFileName(QString name, Tileset::TWBTLayer layer);
 
-	template<typename... Args>
-	void render(QPainter &painter, const QRect &dest,
-	            unsigned int tile, Args &&... args) const
-	{
-		render(painter, dest, _tileset, tile, std::forward<Args>(args)...);
-	}
+	// Transparent images of the tileset size (only imageCount() are allocated)
+	images_t blankImages() const;
+	// Thread-safe, draw the sources of a layer alternative on top of images
+	void compositeLayer(images_t &images, unsigned int layer, unsigned int alternative) const;
+
+	// Files of a source (the -bg and -top files are included in TWBT mode)
+	std::vector<QString> sourceFileNames(const QString &name) const;
+	// Thread-safe, decode the source if it was not already loaded.
+	const source_tiles_t &sourceTiles(const source_t &source) const;
+	// Thread-safe, load the source from sheets already decoded from its
+	// sourceFileNames (null for missing files), unless it was already loaded.
+	void loadSource(const source_t &source, const std::vector<QImage> &sheets) const;
+	// Thread-safe, hash of the source files content.
+	const QByteArray &sourceHash(const source_t &source) const;
+
+	struct cell_t {
+		QRect dest;
+		unsigned int tile;
+		QColor foreground, background; // unused when rendering without colors
+	};
+	// Render cells, which must not overlap. Painter state changes are done
+	// once for each composition step of the batch instead of for each cell.
+	void renderCells(QPainter &painter, const std::vector<cell_t> &cells, bool use_colors) const;
+	// Same as renderCells, but drawing from images of another selection (see compositeLayer).
+	void renderCellsFrom(const images_t &images, QPainter &painter,
+	                     const std::vector<cell_t> &cells, bool use_colors) const;
 
-	template<typename... Args>
-	QPixmap renderAlternativeIcon(const layer_t::alternative_t &alternative, Args &&... args) const
-	{
-		if (alternative.sources.empty())
-			return QPixmap();
-		auto source = alternative.sources[alternative.icon_source].first;
-		if (!source)
-			return QPixmap();
-		QPixmap icon(_info.tileSize());
-		icon.fill(Qt::transparent);
-		{
-			QPainter painter(&icon);
-			render(painter, icon.rect(), *source, alternative.icon_tile, std::forward<Args>(args)...);
-		}
-		return icon;
-	}
+	// Bytes of the source tiles stored in the pool (counted for each source
+	// using a pooled tile) and of the assembled images, including those of cached
+	// selections.
+	qint64 decodedBytes() const;
+
+	// Key identifying the icon content for IconCache, empty if the alternative has no icon.
+	QByteArray alternativeIconKey(const layer_t::alternative_t &alternative) const;
+
+	// Thread-safe, only reads the alternative sources.
+	QImage renderAlternativeIcon(const layer_t::alternative_t &alternative) const;
 
 signals:
 	void tilesetUpdated();
 
 private:
-	const source_t *loadSourceTileset(const QString &name);
+	const source_t *loadSourceTileset(const QString &name, Resampler::Filter filter);
+	// Split a source image in tiles of the tileset tile size.
+	std::vector<QImage> splitSheet(const QImage &image, Resampler::Filter filter) const;
+	// Split a sheet and add its tiles to the pool as the image-th tiles of source
+	void addSourceSheet(const source_t &source, unsigned int image, const QImage &sheet) const;
+	// Images of a single source tile, tile_rect is set to their common rect.
+	images_t tileImages(const source_t &source, unsigned int tile, QRect &tile_rect) const;
+	// Assemble the current selection, or take it from _assembled
 	void buildTileset();
+	// Select the render functions and image count for _mode
+	void setupMode();
 
-	template<typename... Args>
-	void render(QPainter &painter, const QRect &dest,
-	            const std::array<QPixmap, PixmapCount> &pixmaps,
-	            unsigned int tile, Args &&... args) const
-	{
-		switch (_mode) {
-		case Mode::Normal:
-			normal_render(painter, dest, pixmaps, tile, std::forward<Args>(args)...);
-			return;
-		case Mode::TWBT:
-			twbt_render(painter, dest, pixmaps, tile, std::forward<Args>(args)...);
-			return;
-		case Mode::Creature:
-			normal_render(painter, dest, pixmaps, tile);
-			return;
-		}
-	}
-
-	void normal_render(QPainter &p, const QRect &dest, const std::array<QPixmap, PixmapCount> &pixmaps,
-	                   unsigned int tile) const;
-	void normal_render(QPainter &p, const QRect &dest, const std::array<QPixmap, PixmapCount> &pixmaps,
-	                   unsigned int tile, const QColor &foreground, const QColor &background) const;
-	void twbt_render(QPainter &p, const QRect &dest, const std::array<QPixmap, PixmapCount> &pixmaps,
-	                 unsigned int tile) const;
-	void twbt_render(QPainter &p, const QRect &dest, const std::array<QPixmap, PixmapCount> &pixmaps,
-	                 unsigned int tile, const QColor &foreground, const QColor &background) const;
+	// A cell with its source rect in the images
+	struct draw_t {
+		QRect dest, src;
+		QColor foreground, background;
+	};
+	using draws_t = std::vector<draw_t>;
+	void render(QPainter &painter, const images_t &images, const draws_t &draws, bool use_colors) const;
+
+	void normal_render(QPainter &p, const images_t &images, const draws_t &draws) const;
+	void normal_colored_render(QPainter &p, const images_t &images, const draws_t &draws) const;
+	void twbt_render(QPainter &p, const images_t &images, const draws_t &draws) const;
+	void twbt_colored_render(QPainter &p, const images_t &images, const draws_t &draws) const;
 
+	TilePool *_pool;
 	Mode _mode;
+	// chosen once by setupMode instead of switching on the mode for every cell
+	unsigned int _image_count;
+	void (Tileset::*_render)(QPainter &, const images_t &, const draws_t &) const;
+	void (Tileset::*_colored_render)(QPainter &, const images_t &, const draws_t &) const; // Creature ignores colors
 	std::vector<layer_t> _layers;
-	std::map<QString, source_t, std::less<>> _sources;
+	std::map<std::pair<QString, Resampler::Filter>, source_t> _sources;
 	TilemapInfo _info;
-	std::array<QPixmap, PixmapCount> _tileset;
+	QColor _color_key;
+	images_t _tileset;
+	// Most recently used first, _tileset shares the images of the front entry
+	std::list<std::pair<std::vector<unsigned int>, images_t>> _assembled;
+	qint64 _assembled_bytes;
 	QString _output;
+	std::vector<QString> _dependencies;
+	mutable std::atomic<qint64> _source_bytes;
 };
 
 #endif // TILESET_H
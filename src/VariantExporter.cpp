@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "VariantExporter.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <set>
+
+#include "BandedAssembler.h"
+#include "FileLineReader.h"
+#include "Pack.h"
+#include "Tileset.h"
+
+#include <QtDebug>
+
+VariantExporter::VariantExporter(const Pack &pack)
+        : _pack(pack)
+{
+}
+
+bool VariantExporter::load(const QString &filename)
+{
+	QFile file(filename);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		qCritical().noquote() << tr("Failed to open \"%1\".").arg(filename);
+		return false;
+	}
+	const auto &tilesets = _pack.tilesets();
+	bool ok = true;
+	auto error = [&ok] (const QString &message) {
+		qCritical().noquote() << message;
+		ok = false;
+	};
+	FileLineReader reader(&file);
+	variant_t *variant = nullptr;
+	while (reader) {
+		auto line = reader.nextLine().trimmed();
+		if (line.isEmpty())
+			continue;
+		auto params = line.splitRef(':');
+		if (params[0] == "variant") {
+			auto name = line.section(':', 1);
+			if (name.isEmpty()) {
+				error(reader.formatError(tr("Missing variant name")));
+				variant = nullptr;
+				continue;
+			}
+			if (std::any_of(_variants.begin(), _variants.end(), [&name] (const variant_t &v) {
+					return v.name == name;
+				}))
+				error(reader.formatError(tr("Duplicate variant name: %1").arg(name)));
+			_variants.emplace_back();
+			variant = &_variants.back();
+			variant->name = name;
+			for (const auto &tileset: tilesets)
+				variant->selection.emplace_back(tileset->layers().size(), 0);
+		}
+		else if (params[0] == "select") {
+			if (!variant) {
+				error(reader.formatError(tr("\"select\" must be after a variant")));
+				continue;
+			}
+			if (params.size() < 4) {
+				error(reader.formatError(tr("Invalid parameter count")));
+				continue;
+			}
+			bool index_ok;
+			auto tileset_index = params[1].toUInt(&index_ok) - 1;
+			if (!index_ok || tileset_index >= tilesets.size()) {
+				error(reader.formatError(tr("Invalid tileset index")));
+				continue;
+			}
+			const auto &layers = tilesets[tileset_index]->layers();
+			auto layer_index = params[2].toUInt(&index_ok) - 1;
+			if (!index_ok || layer_index >= layers.size()) {
+				error(reader.formatError(tr("Invalid layer index")));
+				continue;
+			}
+			const auto &alternatives = layers[layer_index].alternatives;
+			auto name = line.section(':', 3);
+			auto it = std::find_if(alternatives.begin(), alternatives.end(),
+			                       [&name] (const Tileset::layer_t::alternative_t &alternative) {
+				return alternative.name == name;
+			});
+			unsigned int alternative;
+			if (it != alternatives.end())
+				alternative = static_cast<unsigned int>(std::distance(alternatives.begin(), it));
+			else {
+				alternative = name.toUInt(&index_ok);
+				if (!index_ok || alternative >= alternatives.size()) {
+					error(reader.formatError(tr("Unknown alternative: %1").arg(name)));
+					continue;
+				}
+			}
+			variant->selection[tileset_index][layer_index] = alternative;
+		}
+		else {
+			error(reader.formatError(tr("Invalid variant option: %1").arg(params[0].toString())));
+		}
+	}
+	if (_variants.empty())
+		error(tr("No variant in %1").arg(filename));
+	return ok;
+}
+
+bool VariantExporter::exportAll(const QString &output_dir) const
+{
+	struct save_job_t {
+		QString filename;
+		QImage image;
+	};
+	std::vector<save_job_t> save_jobs;
+
+	const auto &tilesets = _pack.tilesets();
+	for (unsigned int tileset_index = 0; tileset_index < tilesets.size(); ++tileset_index) {
+		const auto &tileset = *tilesets[tileset_index];
+		using selection_t = std::vector<unsigned int>;
+		// Build composites layer by layer, one for each distinct selection
+		// prefix, each one starting from the composite of its parent prefix.
+		std::map<selection_t, Tileset::images_t> composites;
+		composites.emplace(selection_t(), tileset.blankImages());
+		for (unsigned int depth = 0; depth < tileset.layers().size(); ++depth) {
+			std::set<selection_t> prefixes;
+			for (const auto &variant: _variants) {
+				const auto &selection = variant.selection[tileset_index];
+				prefixes.emplace(selection.begin(), selection.begin() + depth + 1);
+			}
+			std::vector<std::pair<selection_t, Tileset::images_t>> nodes;
+			for (const auto &prefix: prefixes)
+				nodes.emplace_back(prefix, Tileset::images_t());
+			QtConcurrent::blockingMap(nodes, [&] (std::pair<selection_t, Tileset::images_t> &node) {
+				selection_t parent(node.first.begin(), node.first.end() - 1);
+				node.second = composites.at(parent); // shared until painted
+				tileset.compositeLayer(node.second, depth, node.first.back());
+			});
+			composites.clear();
+			for (auto &node: nodes)
+				composites.emplace(std::move(node.first), std::move(node.second));
+		}
+
+		auto outputs = tileset.outputs();
+		for (const auto &variant: _variants) {
+			const auto &images = composites.at(variant.selection[tileset_index]);
+			for (unsigned int i = 0; i < outputs.size(); ++i)
+				save_jobs.push_back({ outputPath(output_dir, variant.name, outputs[i]), images[i] });
+		}
+	}
+
+	_pack.tilePool().logStatistics();
+
+	// Encoding is often the most expensive part, do it in parallel too
+	std::atomic<bool> all_saved(true);
+	QtConcurrent::blockingMap(save_jobs, [&all_saved] (const save_job_t &job) {
+		QFileInfo info(job.filename);
+		if (!QDir().mkpath(info.path()) || !job.image.save(job.filename)) {
+			qCritical().noquote() << tr("Failed to save %1").arg(job.filename);
+			all_saved = false;
+		}
+		else
+			qInfo().noquote() << tr("Saved %1").arg(job.filename);
+	});
+	return all_saved;
+}
+
+bool VariantExporter::exportBanded(const QString &output_dir, unsigned int band_rows) const
+{
+	struct job_t {
+		QString filename;
+		const Tileset *tileset;
+		const std::vector<unsigned int> *selection;
+		unsigned int image_index;
+	};
+	std::vector<job_t> jobs;
+	const auto &tilesets = _pack.tilesets();
+	for (const auto &variant: _variants) {
+		for (unsigned int tileset_index = 0; tileset_index < tilesets.size(); ++tileset_index) {
+			auto outputs = tilesets[tileset_index]->outputs();
+			for (unsigned int i = 0; i < outputs.size(); ++i)
+				jobs.push_back({
+					outputPath(output_dir, variant.name, outputs[i]),
+					tilesets[tileset_index].get(),
+					&variant.selection[tileset_index],
+					i
+				});
+		}
+	}
+
+	// Each job only keeps a band of its sources and output in memory
+	std::atomic<bool> all_saved(true);
+	QtConcurrent::blockingMap(jobs, [&all_saved, band_rows] (const job_t &job) {
+		QFileInfo info(job.filename);
+		if (!QDir().mkpath(info.path())) {
+			qCritical().noquote() << tr("Failed to save %1").arg(job.filename);
+			all_saved = false;
+			return;
+		}
+		BandedAssembler assembler(*job.tileset, *job.selection, job.image_index);
+		if (!assembler.save(job.filename, band_rows))
+			all_saved = false;
+		else
+			qInfo().noquote() << tr("Saved %1").arg(job.filename);
+	});
+	return all_saved;
+}
+
+QString VariantExporter::outputPath(const QString &output_dir, const QString &variant, const QString &output)
+{
+	// Variant names come from the variants file, keep them inside output_dir
+	static const QRegularExpression unsafe("[^A-Za-z0-9_.-]+");
+	auto directory = QString(variant).replace(unsafe, "_");
+	if (directory.count('.') == directory.size()) // empty, "." or ".."
+		directory.prepend('_');
+	QFileInfo info(output);
+	auto relative_path = info.isAbsolute() ? info.fileName() : output;
+	return QDir(output_dir).filePath(directory + "/" + relative_path);
+}
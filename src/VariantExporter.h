@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef VARIANT_EXPORTER_H
+#define VARIANT_EXPORTER_H
+
+#include <QCoreApplication>
+
+#include <vector>
+
+class Pack;
+
+// Assemble and save every variant listed in a variants file.
+//
+// A variants file lists named selections:
+//
+//     variant:<name>
+//     select:<tileset>:<layer>:<alternative name or index>
+//
+// Tileset and layer indices start at 1, as in the configuration items.
+// Unselected layers use their first alternative. Composites of layer
+// prefixes shared by several variants are only built once.
+class VariantExporter
+{
+	Q_DECLARE_TR_FUNCTIONS(VariantExporter)
+public:
+	explicit VariantExporter(const Pack &pack);
+
+	// Parse a variants file, errors are logged
+	bool load(const QString &filename);
+	// Write outputs of each variant in <output_dir>/<variant name>/
+	bool exportAll(const QString &output_dir) const;
+	// Same as exportAll, but assembling outputs by bands of band_rows tile
+	// rows with BandedAssembler, memory use does not depend on sheet size.
+	bool exportBanded(const QString &output_dir, unsigned int band_rows) const;
+
+private:
+	static QString outputPath(const QString &output_dir, const QString &variant, const QString &output);
+
+	struct variant_t {
+		QString name;
+		// selected alternative for each layer of each tileset
+		std::vector<std::vector<unsigned int>> selection;
+	};
+
+	const Pack &_pack;
+	std::vector<variant_t> _variants;
+};
+
+#endif // VARIANT_EXPORTER_H
@@ -14,17 +14,45 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include "GalleryRenderer.h"
 #include "MainWindow.h"
 #include "LogWindow.h"
+#include "MultiPackBuilder.h"
+#include "Pack.h"
+#include "PackChecker.h"
+#include "RenderServer.h"
+#include "SheetDiff.h"
+#include "VariantExporter.h"
 #include "Version.h"
 
 #include <QApplication>
 #include <QCommandLineParser>
+#include <QThread>
+#include <QtDebug>
+
+#include <cstdio>
+#include <cstring>
 
 #define DEFAULT_CONFIG_PATH "tileset-assembler.ini"
 
+// Modes that never open a window do not need a display
+static bool isHeadless(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; ++i) {
+		for (auto option: { "--build-packs", "--check", "--compile", "--diff", "--gallery", "--serve", "--variants" }) {
+			auto length = std::strlen(option);
+			if (std::strncmp(argv[i], option, length) == 0 &&
+			    (argv[i][length] == '\0' || argv[i][length] == '='))
+				return true;
+		}
+	}
+	return false;
+}
+
 int main(int argc, char *argv[])
 {
+	if (isHeadless(argc, argv) && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+		qputenv("QT_QPA_PLATFORM", "offscreen");
 	QApplication app(argc, argv);
 	app.setApplicationName("Tileset-Assembler");
 	app.setApplicationDisplayName("Tileset Assembler");
@@ -34,13 +62,162 @@ int main(int argc, char *argv[])
 	parser.addPositionalArgument("config_path",
 	                             QApplication::translate("main", "Path to the INI configuration file (default is \"%1\").").arg(DEFAULT_CONFIG_PATH),
 	                             "[config_path]");
+	QCommandLineOption compile_option("compile",
+	                                  QApplication::translate("main", "Compile the pack into a binary bundle loaded at next startup, then exit."));
+	parser.addOption(compile_option);
+	QCommandLineOption check_option("check",
+	                                QApplication::translate("main", "Check the pack without decoding images, print problems as JSON, then exit."));
+	parser.addOption(check_option);
+	QCommandLineOption variants_option("variants",
+	                                   QApplication::translate("main", "Export every variant listed in <file>, then exit."),
+	                                   QApplication::translate("main", "file"));
+	parser.addOption(variants_option);
+	QCommandLineOption output_dir_option("output-dir",
+	                                     QApplication::translate("main", "Directory where variants are exported (default is \"%1\").").arg("variants"),
+	                                     QApplication::translate("main", "directory"),
+	                                     "variants");
+	parser.addOption(output_dir_option);
+	QCommandLineOption band_rows_option("band-rows",
+	                                    QApplication::translate("main", "Export variants by bands of <rows> tile rows, with memory use independent of the sheet size."),
+	                                    QApplication::translate("main", "rows"));
+	parser.addOption(band_rows_option);
+	QCommandLineOption serve_option("serve",
+	                                QApplication::translate("main", "Serve rendered tilesets and previews over HTTP on local <port> instead of opening the window."),
+	                                QApplication::translate("main", "port"));
+	parser.addOption(serve_option);
+	QCommandLineOption gallery_option("gallery",
+	                                  QApplication::translate("main", "Render every preview with every palette and background in <directory>, with an index.json file."),
+	                                  QApplication::translate("main", "directory"));
+	parser.addOption(gallery_option);
+	QCommandLineOption build_packs_option("build-packs",
+	                                      QApplication::translate("main", "Build the outputs of every pack configuration given as argument (directories are searched for .ini files), sharing source decoding between packs."));
+	parser.addOption(build_packs_option);
+	QCommandLineOption jobs_option("jobs",
+	                               QApplication::translate("main", "Run <count> jobs in parallel with --build-packs."),
+	                               QApplication::translate("main", "count"));
+	parser.addOption(jobs_option);
+	QCommandLineOption diff_option("diff",
+	                               QApplication::translate("main", "Compare two output sheets, or two directories of output sheets, tile by tile and print the changed tiles. Exit code is 1 if they differ."));
+	parser.addOption(diff_option);
+	QCommandLineOption diff_output_option("diff-output",
+	                                      QApplication::translate("main", "Write sheets highlighting the changed tiles in <directory> with --diff."),
+	                                      QApplication::translate("main", "directory"));
+	parser.addOption(diff_output_option);
+	QCommandLineOption diff_grid_option("diff-grid",
+	                                    QApplication::translate("main", "Tilemap <grid> used by --diff, as <columns>x<rows> (default is 16x16)."),
+	                                    QApplication::translate("main", "grid"));
+	parser.addOption(diff_grid_option);
 	parser.addVersionOption();
 	parser.addHelpOption();
 	parser.process(app);
 
+	auto config_path = parser.positionalArguments().value(0, DEFAULT_CONFIG_PATH);
+
+	if (parser.isSet(check_option)) {
+		PackChecker checker(config_path);
+		std::fputs(checker.toJson().constData(), stdout);
+		return checker.errorCount() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (parser.isSet(compile_option)) {
+		Pack pack(config_path, Pack::Source::Text);
+		auto bundle_path = Pack::bundlePath(config_path);
+		if (!pack.compile(bundle_path)) {
+			qCritical().noquote() << QApplication::translate("main", "Failed to write bundle %1").arg(bundle_path);
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (parser.isSet(variants_option)) {
+		unsigned int band_rows = 0;
+		if (parser.isSet(band_rows_option)) {
+			bool ok;
+			band_rows = parser.value(band_rows_option).toUInt(&ok);
+			if (!ok || band_rows == 0) {
+				qCritical().noquote() << QApplication::translate("main", "Invalid band row count: %1").arg(parser.value(band_rows_option));
+				return EXIT_FAILURE;
+			}
+		}
+		// Banded export decodes sources itself, band by band
+		Pack pack(config_path, band_rows > 0 ? Pack::Source::TextParseOnly : Pack::Source::BundleOrText);
+		VariantExporter exporter(pack);
+		if (!exporter.load(parser.value(variants_option)))
+			return EXIT_FAILURE;
+		auto output_dir = parser.value(output_dir_option);
+		auto ok = band_rows > 0
+		          ? exporter.exportBanded(output_dir, band_rows)
+		          : exporter.exportAll(output_dir);
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (parser.isSet(diff_option)) {
+		auto paths = parser.positionalArguments();
+		if (paths.size() != 2) {
+			qCritical().noquote() << QApplication::translate("main", "--diff needs two files or directories");
+			return 2;
+		}
+		QSize grid(16, 16);
+		if (parser.isSet(diff_grid_option)) {
+			auto values = parser.value(diff_grid_option).split('x');
+			bool width_ok = false, height_ok = false;
+			if (values.size() == 2)
+				grid = QSize(values[0].toInt(&width_ok), values[1].toInt(&height_ok));
+			if (!width_ok || !height_ok || grid.isEmpty()) {
+				qCritical().noquote() << QApplication::translate("main", "Invalid grid: %1").arg(parser.value(diff_grid_option));
+				return 2;
+			}
+		}
+		SheetDiff diff(grid);
+		if (parser.isSet(diff_output_option))
+			diff.setDiffDirectory(parser.value(diff_output_option));
+		auto ok = diff.compare(paths[0], paths[1]);
+		std::fputs(diff.toJson().constData(), stdout);
+		if (!ok)
+			return 2;
+		return diff.changedFileCount() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (parser.isSet(build_packs_option)) {
+		int job_count = QThread::idealThreadCount();
+		if (parser.isSet(jobs_option)) {
+			bool ok;
+			job_count = parser.value(jobs_option).toInt(&ok);
+			if (!ok || job_count <= 0) {
+				qCritical().noquote() << QApplication::translate("main", "Invalid job count: %1").arg(parser.value(jobs_option));
+				return EXIT_FAILURE;
+			}
+		}
+		MultiPackBuilder builder(job_count);
+		auto ok = builder.addPacks(parser.positionalArguments());
+		ok = builder.build() && ok;
+		std::fputs(builder.summary().constData(), stdout);
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (parser.isSet(gallery_option)) {
+		Pack pack(config_path);
+		GalleryRenderer gallery(pack);
+		return gallery.render(parser.value(gallery_option)) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (parser.isSet(serve_option)) {
+		bool ok;
+		auto port = parser.value(serve_option).toUShort(&ok);
+		if (!ok) {
+			qCritical().noquote() << QApplication::translate("main", "Invalid port: %1").arg(parser.value(serve_option));
+			return EXIT_FAILURE;
+		}
+		Pack pack(config_path);
+		RenderServer server(pack);
+		if (!server.listen(QHostAddress::LocalHost, port))
+			return EXIT_FAILURE;
+		return app.exec();
+	}
+
 	qInstallMessageHandler(LogWindow::handleMessage);
 
-	MainWindow window(parser.positionalArguments().value(0, DEFAULT_CONFIG_PATH));
+	MainWindow window(config_path);
 	window.show();
 
 	return app.exec();
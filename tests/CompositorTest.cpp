@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2018 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+// Compares Compositor with QPainter for every composition mode and source
+// format on random images, and fails if any result differs.
+#include <QGuiApplication>
+#include <QPainter>
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+
+#include "Compositor.h"
+
+#include <QtDebug>
+
+// Random premultiplied image with many fully transparent and opaque pixels,
+// using only colors that format can represent
+static QImage randomImage(std::mt19937 &rng, const QSize &size, Compositor::Format format)
+{
+	std::uniform_int_distribution<int> byte(0, 255), kind(0, 3);
+	QImage image(size, QImage::Format_ARGB32_Premultiplied);
+	for (int y = 0; y < size.height(); ++y) {
+		auto line = reinterpret_cast<QRgb *>(image.scanLine(y));
+		for (int x = 0; x < size.width(); ++x) {
+			int alpha;
+			switch (kind(rng)) {
+			case 0: alpha = 0; break;
+			case 1: alpha = 255; break;
+			default: alpha = byte(rng);
+			}
+			auto channel = [&] () { return alpha == 0 ? 0 : byte(rng) % (alpha + 1); };
+			switch (format) {
+			case Compositor::Format::ARGB32Premultiplied:
+				line[x] = qRgba(channel(), channel(), channel(), alpha);
+				break;
+			case Compositor::Format::WhiteAlpha8:
+				line[x] = qRgba(alpha, alpha, alpha, alpha);
+				break;
+			case Compositor::Format::GrayAlpha16: {
+				auto gray = channel();
+				line[x] = qRgba(gray, gray, gray, alpha);
+				break;
+			}
+			}
+		}
+	}
+	return image;
+}
+
+int main(int argc, char *argv[])
+{
+	QGuiApplication app(argc, argv);
+
+	// Odd sizes and offsets exercise clipping and the scalar tails of SIMD rows
+	const QSize size(37, 29);
+	const QPoint pos(-3, 5);
+	std::mt19937 rng(42);
+	bool ok = true;
+	for (auto format: { Compositor::Format::ARGB32Premultiplied,
+	                    Compositor::Format::WhiteAlpha8,
+	                    Compositor::Format::GrayAlpha16 }) {
+		for (int m = QPainter::CompositionMode_SourceOver; m <= QPainter::CompositionMode_Exclusion; ++m) {
+			auto mode = static_cast<QPainter::CompositionMode>(m);
+			auto src = randomImage(rng, size, format);
+			auto expected = randomImage(rng, size, Compositor::Format::ARGB32Premultiplied);
+			auto result = expected.copy();
+			{
+				QPainter painter(&expected);
+				painter.setCompositionMode(mode);
+				painter.drawImage(pos, src);
+			}
+			if (format == Compositor::Format::ARGB32Premultiplied)
+				Compositor::composite(result, pos, src, mode);
+			else {
+				auto pixels = Compositor::toFormat(src, format);
+				Compositor::composite(result, pos, reinterpret_cast<const uchar *>(pixels.constData()),
+				                      size.width() * Compositor::bytesPerPixel(format), size, format, mode);
+			}
+			int max_difference = 0, different_pixels = 0;
+			for (int y = 0; y < size.height(); ++y) {
+				auto expected_line = reinterpret_cast<const QRgb *>(expected.constScanLine(y));
+				auto result_line = reinterpret_cast<const QRgb *>(result.constScanLine(y));
+				for (int x = 0; x < size.width(); ++x) {
+					auto e = expected_line[x], r = result_line[x];
+					if (e == r)
+						continue;
+					++different_pixels;
+					for (int shift = 0; shift < 32; shift += 8)
+						max_difference = std::max(max_difference,
+						                          std::abs(int((e >> shift) & 0xff) - int((r >> shift) & 0xff)));
+				}
+			}
+			if (different_pixels > 0) {
+				qCritical().noquote() << QString("Composition mode %1, source format %2: %3 different pixels, maximum channel difference %4")
+				                         .arg(m).arg(static_cast<int>(format)).arg(different_pixels).arg(max_difference);
+				ok = false;
+			}
+			else
+				qInfo().noquote() << QString("Composition mode %1, source format %2: identical").arg(m).arg(static_cast<int>(format));
+		}
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}